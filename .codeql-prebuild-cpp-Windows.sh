@@ -20,6 +20,7 @@ dependencies=(
   "mingw-w64-ucrt-x86_64-openssl"
   "mingw-w64-ucrt-x86_64-opus"
   "mingw-w64-ucrt-x86_64-toolchain"
+  "mingw-w64-ucrt-x86_64-zlib"
 )
 pacman -S --noconfirm "${dependencies[@]}"
 
@@ -20,6 +20,11 @@ include("${CMAKE_MODULE_PATH}/dependencies/nlohmann_json.cmake")
 find_package(OpenSSL REQUIRED)
 find_package(PkgConfig REQUIRED)
 find_package(Threads REQUIRED)
+if(WIN32)
+    # link zlib statically, like the other dependencies
+    set(ZLIB_USE_STATIC_LIBS ON)
+endif()
+find_package(ZLIB REQUIRED)
 pkg_check_modules(CURL REQUIRED libcurl)
 
 # miniupnp
@@ -19,6 +19,9 @@ option(SUNSHINE_CONFIGURE_ONLY "Configure special files only, then exit." OFF)
 
 option(SUNSHINE_ENABLE_TRAY "Enable system tray icon. This option will be ignored on macOS." ON)
 
+set(SUNSHINE_LOG_MIN_LEVEL 0
+        CACHE STRING "Log statements on hot paths below this level (0 = verbose, 1 = debug) are compiled out.")
+
 option(SUNSHINE_SYSTEM_WAYLAND_PROTOCOLS "Use system installation of wayland-protocols rather than the submodule." OFF)
 
 if(APPLE)
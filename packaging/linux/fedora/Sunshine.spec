@@ -49,6 +49,7 @@ BuildRequires: systemd-rpm-macros
 %{?sysusers_requires_compat}
 BuildRequires: wget
 BuildRequires: which
+BuildRequires: zlib-devel
 
 # for unit tests
 BuildRequires: xorg-x11-server-Xvfb
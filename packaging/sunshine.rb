@@ -38,6 +38,8 @@ class @PROJECT_NAME@ < Formula
   depends_on "boost" => :recommended
   depends_on "icu4c" => :recommended
 
+  uses_from_macos "zlib"
+
   on_linux do
     depends_on "avahi"
     depends_on "libcap"
@@ -0,0 +1,268 @@
+/**
+ * @file src/asset_cache.cpp
+ * @brief Definitions for the in-memory HTTP asset cache.
+ */
+// standard includes
+#include <fstream>
+
+// lib includes
+#include <boost/algorithm/string.hpp>
+#include <zlib.h>
+
+// local includes
+#include "asset_cache.h"
+#include "crypto.h"
+#include "logging.h"
+#include "utility.h"
+
+using namespace std::literals;
+
+namespace asset_cache {
+  namespace fs = std::filesystem;
+
+  std::string gzip(const std::string_view &data) {
+    z_stream stream {};
+
+    // 15 window bits + 16 selects the gzip wrapper instead of the raw zlib one
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+      return {};
+    }
+    auto fg = util::fail_guard([&stream]() {
+      deflateEnd(&stream);
+    });
+
+    std::string compressed;
+    compressed.resize(deflateBound(&stream, data.size()));
+
+    stream.next_in = (Bytef *) data.data();
+    stream.avail_in = (uInt) data.size();
+    stream.next_out = (Bytef *) compressed.data();
+    stream.avail_out = (uInt) compressed.size();
+
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+      return {};
+    }
+
+    compressed.resize(stream.total_out);
+    return compressed;
+  }
+
+  std::string make_etag(const std::string_view &data) {
+    auto hash = crypto::hash(data);
+
+    // Half of a SHA-256 is plenty to tell two versions of an asset apart
+    return '"' + util::hex_vec(std::begin(hash), std::begin(hash) + hash.size() / 2, true) + '"';
+  }
+
+  bool is_compressible(const std::string_view &content_type) {
+    return content_type.starts_with("text/"sv) ||
+           content_type == "application/javascript"sv ||
+           content_type == "application/json"sv ||
+           content_type == "image/svg+xml"sv ||
+           content_type == "image/x-icon"sv;
+  }
+
+  asset_ptr make_asset(std::string data, std::string content_type, bool compress) {
+    auto asset = std::make_shared<asset_t>();
+
+    asset->etag = make_etag(data);
+    if (compress) {
+      asset->gzip_data = gzip(data);
+
+      // Not worth a Content-Encoding negotiation if it doesn't save anything
+      if (asset->gzip_data.size() >= data.size()) {
+        asset->gzip_data.clear();
+      } else {
+        // Same hash, but a different representation must not share the strong ETag
+        asset->gzip_etag = asset->etag;
+        asset->gzip_etag.insert(asset->gzip_etag.size() - 1, "-gz");
+      }
+    }
+    asset->data = std::move(data);
+    asset->content_type = std::move(content_type);
+
+    return asset;
+  }
+
+  bool etag_matches(const std::string_view &if_none_match, const std::string_view &etag) {
+    std::vector<std::string> candidates;
+    boost::split(candidates, if_none_match, boost::is_any_of(","));
+
+    for (auto &candidate : candidates) {
+      boost::trim(candidate);
+
+      // Weak comparison is what RFC 9110 mandates for If-None-Match
+      if (candidate.starts_with("W/"sv)) {
+        candidate.erase(0, 2);
+      }
+
+      if (candidate == "*"sv || candidate == etag) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  bool accepts_gzip(const std::string_view &accept_encoding) {
+    std::vector<std::string> codings;
+    boost::split(codings, accept_encoding, boost::is_any_of(","));
+
+    for (auto &coding : codings) {
+      std::vector<std::string> params;
+      boost::split(params, coding, boost::is_any_of(";"));
+      boost::trim(params[0]);
+
+      if (!boost::iequals(params[0], "gzip"sv) && params[0] != "*"sv) {
+        continue;
+      }
+
+      // An explicit q=0 means the coding is not acceptable
+      for (auto it = std::next(std::begin(params)); it != std::end(params); ++it) {
+        auto param = boost::trim_copy(*it);
+        if (param.starts_with("q="sv) && std::strtod(param.c_str() + 2, nullptr) <= 0.0) {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    return false;
+  }
+
+  std::size_t cache_t::load_directory(const fs::path &root, const std::map<std::string, std::string> &mime_types) {
+    std::error_code ec;
+    fs::recursive_directory_iterator it {root, ec};
+    if (ec) {
+      BOOST_LOG(warning) << "Couldn't load assets from "sv << root << ": "sv << ec.message();
+      return 0;
+    }
+
+    std::size_t loaded = 0;
+    for (; it != fs::recursive_directory_iterator(); it.increment(ec)) {
+      if (ec) {
+        BOOST_LOG(warning) << "Couldn't list assets in "sv << root << ": "sv << ec.message();
+        break;
+      }
+
+      if (!it->is_regular_file(ec)) {
+        continue;
+      }
+
+      auto extension = it->path().extension().string();
+      if (extension.empty()) {
+        continue;
+      }
+
+      auto mime_type = mime_types.find(extension.substr(1));
+      if (mime_type == std::end(mime_types)) {
+        continue;
+      }
+
+      std::ifstream in(it->path(), std::ios::binary);
+      if (!in) {
+        BOOST_LOG(warning) << "Couldn't read asset "sv << it->path();
+        continue;
+      }
+      std::string data {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+
+      auto path = fs::relative(it->path(), root, ec).generic_string();
+      _assets.insert_or_assign(path, make_asset(std::move(data), mime_type->second, is_compressible(mime_type->second)));
+      ++loaded;
+    }
+
+    return loaded;
+  }
+
+  asset_ptr cache_t::find(const std::string &path) const {
+    auto it = _assets.find(path);
+    if (it == std::end(_assets)) {
+      return nullptr;
+    }
+
+    return it->second;
+  }
+
+  std::size_t cache_t::size_bytes() const {
+    std::size_t total = 0;
+    for (auto &[_, asset] : _assets) {
+      total += asset->data.size() + asset->gzip_data.size();
+    }
+
+    return total;
+  }
+
+  file_cache_t::file_cache_t(std::size_t capacity_bytes):
+      _capacity {capacity_bytes} {
+  }
+
+  asset_ptr file_cache_t::load(const fs::path &file, const std::string &content_type) {
+    auto key = file.string();
+
+    std::error_code ec;
+    auto mtime = fs::last_write_time(file, ec);
+    auto size = ec ? 0 : fs::file_size(file, ec);
+
+    {
+      std::lock_guard lg {_lock};
+
+      auto it = _entries.find(key);
+      if (it != std::end(_entries)) {
+        if (!ec && it->second.mtime == mtime && it->second.size == size && it->second.asset->content_type == content_type) {
+          _lru.splice(std::begin(_lru), _lru, it->second.lru);
+          return it->second.asset;
+        }
+
+        erase(it);
+      }
+    }
+
+    if (ec) {
+      BOOST_LOG(warning) << "Couldn't read asset "sv << file << ": "sv << ec.message();
+      return nullptr;
+    }
+
+    // Read without holding the lock, so a slow disk doesn't stall requests for cached files
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+      BOOST_LOG(warning) << "Couldn't read asset "sv << file;
+      return nullptr;
+    }
+    std::string data {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+
+    auto asset = make_asset(std::move(data), content_type, false);
+    if (asset->data.size() > _capacity) {
+      return asset;
+    }
+
+    std::lock_guard lg {_lock};
+
+    // Another request may have loaded the same file in the meantime
+    auto it = _entries.find(key);
+    if (it != std::end(_entries)) {
+      erase(it);
+    }
+
+    _lru.emplace_front(key);
+    _entries.emplace(std::move(key), entry_t {mtime, size, asset, std::begin(_lru)});
+    _size += asset->data.size();
+
+    while (_size > _capacity) {
+      erase(_entries.find(_lru.back()));
+    }
+
+    return asset;
+  }
+
+  std::size_t file_cache_t::size_bytes() const {
+    std::lock_guard lg {_lock};
+    return _size;
+  }
+
+  void file_cache_t::erase(std::unordered_map<std::string, entry_t>::iterator it) {
+    _size -= it->second.asset->data.size();
+    _lru.erase(it->second.lru);
+    _entries.erase(it);
+  }
+}  // namespace asset_cache
@@ -0,0 +1,190 @@
+/**
+ * @file src/asset_cache.h
+ * @brief Declarations for the in-memory HTTP asset cache.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// lib includes
+#include <Simple-Web-Server/utility.hpp>
+
+/**
+ * @brief Static files kept in memory, together with everything needed to serve them.
+ */
+namespace asset_cache {
+
+  struct asset_t {
+    std::string content_type;
+    std::string etag;  ///< Strong, quoted ETag derived from the content
+    std::string data;
+    std::string gzip_data;  ///< Empty when compression would not make the asset smaller
+    std::string gzip_etag;  ///< ETag of the gzip variant, empty along with `gzip_data`
+  };
+
+  using asset_ptr = std::shared_ptr<const asset_t>;
+
+  /**
+   * @brief Compress data into the gzip format.
+   * @param data The data to compress.
+   * @return The compressed data, or an empty string on failure.
+   */
+  std::string gzip(const std::string_view &data);
+
+  /**
+   * @brief Build a strong ETag from the content of an asset.
+   * @param data The asset content.
+   * @return The quoted ETag.
+   * @examples
+   * auto etag = asset_cache::make_etag("hello");  // "\"2CF24DBA5FB0A30E26E83B2AC5B9E29E\""
+   * @examples_end
+   */
+  std::string make_etag(const std::string_view &data);
+
+  /**
+   * @brief Create an asset from its content.
+   * @param data The asset content.
+   * @param content_type The value of the Content-Type header.
+   * @param compress Whether a gzip variant should be kept along the raw data.
+   */
+  asset_ptr make_asset(std::string data, std::string content_type, bool compress);
+
+  /**
+   * @brief Check whether a content type benefits from compression.
+   * @param content_type The content type.
+   * @return `true` for text based content, `false` for already compressed formats.
+   */
+  bool is_compressible(const std::string_view &content_type);
+
+  /**
+   * @brief Check an `If-None-Match` header value against an ETag.
+   * @param if_none_match The header value, a list of ETags or `*`.
+   * @param etag The current ETag of the asset.
+   * @return `true` if the client copy is up to date.
+   */
+  bool etag_matches(const std::string_view &if_none_match, const std::string_view &etag);
+
+  /**
+   * @brief Check whether an `Accept-Encoding` header value allows gzip.
+   * @param accept_encoding The header value.
+   * @return `true` if the client accepts gzip encoded content.
+   */
+  bool accepts_gzip(const std::string_view &accept_encoding);
+
+  class cache_t {
+  public:
+    /**
+     * @brief Load every file with a known content type below a directory.
+     * @param root The directory to load.
+     * @param mime_types Map of file extensions (without the leading period) to content types.
+     * @return The number of assets loaded.
+     */
+    std::size_t load_directory(const std::filesystem::path &root, const std::map<std::string, std::string> &mime_types);
+
+    /**
+     * @brief Find an asset.
+     * @param path The path of the asset, relative to the loaded directory, using forward slashes.
+     * @return The asset, or `nullptr` if it wasn't loaded.
+     */
+    asset_ptr find(const std::string &path) const;
+
+    /**
+     * @brief Get the total size of the cached data, including compressed variants.
+     */
+    std::size_t size_bytes() const;
+
+  private:
+    std::unordered_map<std::string, asset_ptr> _assets;
+  };
+
+  /**
+   * @brief Files loaded on demand, kept in memory until they change or the cache runs out of space.
+   */
+  class file_cache_t {
+  public:
+    /**
+     * @brief Create an empty cache.
+     * @param capacity_bytes The amount of file data to keep, the least recently used files are dropped first.
+     */
+    explicit file_cache_t(std::size_t capacity_bytes);
+
+    /**
+     * @brief Get a file, reading it again only if its size or modification time changed.
+     * @param file The file to load.
+     * @param content_type The value of the Content-Type header.
+     * @return The asset, or `nullptr` if the file couldn't be read.
+     */
+    asset_ptr load(const std::filesystem::path &file, const std::string &content_type);
+
+    /**
+     * @brief Get the total size of the cached data.
+     */
+    std::size_t size_bytes() const;
+
+  private:
+    struct entry_t {
+      std::filesystem::file_time_type mtime;
+      std::uintmax_t size;
+      asset_ptr asset;
+      std::list<std::string>::iterator lru;  ///< Position in `_lru`, most recently used first
+    };
+
+    void erase(std::unordered_map<std::string, entry_t>::iterator it);
+
+    mutable std::mutex _lock;
+    std::size_t _capacity;
+    std::size_t _size {0};
+    std::list<std::string> _lru;
+    std::unordered_map<std::string, entry_t> _entries;
+  };
+
+  /**
+   * @brief Write an asset to a response, honouring conditional and encoding headers of the request.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * @param asset The asset to send.
+   * @param headers Additional response headers.
+   */
+  template<class Response, class Request>
+  void write(std::shared_ptr<Response> &response, std::shared_ptr<Request> &request, const asset_t &asset, SimpleWeb::CaseInsensitiveMultimap headers = {}) {
+    auto gzip = false;
+    if (!asset.gzip_data.empty()) {
+      auto accept_encoding = request->header.find("Accept-Encoding");
+      gzip = accept_encoding != std::end(request->header) && accepts_gzip(accept_encoding->second);
+    }
+
+    // Both variants have their own strong ETag, a cache may hold either of them
+    headers.emplace("ETag", gzip ? asset.gzip_etag : asset.etag);
+    headers.emplace("Cache-Control", "no-cache");
+    if (!asset.gzip_data.empty()) {
+      headers.emplace("Vary", "Accept-Encoding");
+    }
+
+    auto if_none_match = request->header.find("If-None-Match");
+    if (if_none_match != std::end(request->header) &&
+        (etag_matches(if_none_match->second, asset.etag) || (!asset.gzip_etag.empty() && etag_matches(if_none_match->second, asset.gzip_etag)))) {
+      response->write(SimpleWeb::StatusCode::redirection_not_modified, headers);
+      return;
+    }
+
+    if (headers.find("Content-Type") == std::end(headers)) {
+      headers.emplace("Content-Type", asset.content_type);
+    }
+    if (gzip) {
+      headers.emplace("Content-Encoding", "gzip");
+      response->write(SimpleWeb::StatusCode::success_ok, asset.gzip_data, headers);
+      return;
+    }
+
+    response->write(SimpleWeb::StatusCode::success_ok, asset.data, headers);
+  }
+}  // namespace asset_cache
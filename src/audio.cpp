@@ -3,6 +3,10 @@
  * @brief Definitions for audio capture and encoding.
  */
 // standard includes
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <sstream>
 #include <thread>
 
 // lib includes
@@ -21,6 +25,10 @@ namespace audio {
   using namespace std::literals;
   using opus_t = util::safe_ptr<OpusMSEncoder, opus_multistream_encoder_destroy>;
   using sample_queue_t = std::shared_ptr<safe::queue_t<std::vector<float>>>;
+  using sample_pool_t = std::shared_ptr<buffer_pool_t<std::vector<float>>>;
+
+  // Large enough for any Opus frame we produce
+  constexpr std::size_t MAX_PACKET_SIZE = 1400;
 
   static int start_audio_control(audio_ctx_t &ctx);
   static void stop_audio_control(audio_ctx_t &);
@@ -83,13 +91,92 @@ namespace audio {
     },
   };
 
-  void encodeThread(sample_queue_t samples, config_t config, void *channel_data) {
-    auto packets = mail::man->queue<packet_t>(mail::audio_packets);
-    auto stream = stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])];
-    if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
-      apply_surround_params(stream, config.customStreamParams);
+  buffer_pool_t<buffer_t> &packet_pool() {
+    // Shared by all sessions, since every packet ends up on the same broadcast thread
+    static buffer_pool_t<buffer_t> pool {64};
+    return pool;
+  }
+
+  /**
+   * @brief A capture and Opus encoder, shared by every session streaming the same sink with the same parameters.
+   */
+  struct fan_out_t {
+    fan_out_t(audio_ctx_ref_t ref, const config_t &config):
+        ref {std::move(ref)},
+        config {config},
+        stream {stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])]},
+        samples {std::make_shared<sample_queue_t::element_type>(30)},
+        sample_pool {std::make_shared<sample_pool_t::element_type>(32)} {
+      // The custom mapping has to point into our copy of the config, the session's one may go away first
+      if (this->config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
+        apply_surround_params(stream, this->config.customStreamParams);
+      }
+    }
+
+    ~fan_out_t() {
+      stop_event.raise(true);
+      if (capture_thread.joinable()) {
+        capture_thread.join();
+      }
+
+      samples->stop();
+      if (encode_thread.joinable()) {
+        encode_thread.join();
+
+        BOOST_LOG(debug) << "Audio buffers: "sv << sample_pool->allocated << " sample buffers allocated, "sv << sample_pool->reused << " reused; "sv
+                         << packet_pool().allocated << " packets allocated, "sv << packet_pool().reused << " reused (all sessions)"sv;
+      }
     }
 
+    int frame_size() const {
+      return config.packetDuration * stream.sampleRate / 1000;
+    }
+
+    void subscribe(void *channel_data) {
+      std::lock_guard lg {subscribers_lock};
+      subscribers.emplace_back(channel_data);
+    }
+
+    void unsubscribe(void *channel_data) {
+      std::lock_guard lg {subscribers_lock};
+      std::erase(subscribers, channel_data);
+    }
+
+    audio_ctx_ref_t ref;
+    config_t config;
+    opus_stream_config_t stream;
+    std::unique_ptr<platf::mic_t> mic;
+
+    // The channel data of every session the packets are delivered to
+    std::mutex subscribers_lock;
+    std::vector<void *> subscribers;
+
+    safe::signal_t stop_event;
+    sample_queue_t samples;
+    sample_pool_t sample_pool;
+    std::thread capture_thread;
+    std::thread encode_thread;
+  };
+
+  // Running captures by sink and stream parameters, owned by their subscribers
+  std::mutex fan_outs_lock;
+  std::map<std::string, std::weak_ptr<fan_out_t>> fan_outs;
+
+  std::string fan_out_key(const std::string &sink, const config_t &config, const opus_stream_config_t &stream) {
+    std::stringstream ss;
+    ss << sink << '|' << config.packetDuration << '|' << stream.channelCount << '|' << stream.streams << '|'
+       << stream.coupledStreams << '|' << stream.bitrate << '|';
+    std::for_each_n(stream.mapping, stream.channelCount, [&ss](std::uint8_t pos) {
+      ss << (int) pos << ',';
+    });
+
+    return ss.str();
+  }
+
+  void encodeThread(fan_out_t &fan_out) {
+    auto packets = mail::man->queue<packet_t>(mail::audio_packets);
+    auto &stream = fan_out.stream;
+
     // Encoding takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::high);
 
@@ -110,9 +197,17 @@ namespace audio {
                     << stream.channelCount << " channels, "sv
                     << stream.bitrate / 1000 << " kbps (total), LOWDELAY"sv;
 
-    auto frame_size = config.packetDuration * stream.sampleRate / 1000;
-    while (auto sample = samples->pop()) {
-      buffer_t packet {1400};
+    auto take_packet = []() {
+      auto idle_packet = packet_pool().take();
+      auto packet = idle_packet ? std::move(*idle_packet) : buffer_t {MAX_PACKET_SIZE};
+      packet.fake_resize(MAX_PACKET_SIZE);
+
+      return packet;
+    };
+
+    auto frame_size = fan_out.frame_size();
+    while (auto sample = fan_out.samples->pop()) {
+      auto packet = take_packet();
 
       int bytes = opus_multistream_encode_float(opus.get(), sample->data(), frame_size, std::begin(packet), packet.size());
       if (bytes < 0) {
@@ -123,10 +218,111 @@ namespace audio {
       }
 
       packet.fake_resize(bytes);
-      packets->raise(channel_data, std::move(packet));
+      fan_out.sample_pool->give(std::move(*sample));
+
+      std::lock_guard lg {fan_out.subscribers_lock};
+      if (fan_out.subscribers.empty()) {
+        packet_pool().give(std::move(packet));
+        continue;
+      }
+
+      // Every session encrypts and sends its own copy, the last one gets the original
+      for (auto it = std::begin(fan_out.subscribers); std::next(it) != std::end(fan_out.subscribers); ++it) {
+        auto copy = take_packet();
+        std::copy_n(std::begin(packet), bytes, std::begin(copy));
+        copy.fake_resize(bytes);
+
+        packets->raise(*it, std::move(copy));
+      }
+      packets->raise(fan_out.subscribers.back(), std::move(packet));
     }
   }
 
+  void captureThread(fan_out_t &fan_out) {
+    auto &stream = fan_out.stream;
+    auto &control = fan_out.ref->control;
+
+    // Capture takes place on this thread
+    platf::adjust_thread_priority(platf::thread_priority_e::critical);
+
+    // Sessions that start after the capture failed open a new one
+    auto fg = util::fail_guard([&]() {
+      fan_out.stop_event.raise(true);
+      fan_out.samples->stop();
+    });
+
+    auto frame_size = fan_out.frame_size();
+    int samples_per_frame = frame_size * stream.channelCount;
+
+    while (!fan_out.stop_event.peek()) {
+      // The capture writes straight into a frame the encoder is done with, if there is one
+      auto sample_buffer = fan_out.sample_pool->take().value_or(std::vector<float> {});
+      sample_buffer.resize(samples_per_frame);
+
+      auto status = fan_out.mic->sample(sample_buffer);
+      switch (status) {
+        case platf::capture_e::ok:
+          break;
+        case platf::capture_e::timeout:
+          continue;
+        case platf::capture_e::reinit:
+          if (config::audio.auto_capture) {
+            BOOST_LOG(info) << "Reinitializing audio capture"sv;
+            fan_out.mic.reset();
+            do {
+              fan_out.mic = control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, frame_size);
+              if (!fan_out.mic) {
+                BOOST_LOG(warning) << "Couldn't re-initialize audio input"sv;
+              }
+            } while (!fan_out.mic && !fan_out.stop_event.view(5s));
+          }
+
+          continue;
+        default:
+          return;
+      }
+
+      fan_out.samples->raise(std::move(sample_buffer));
+    }
+  }
+
+  /**
+   * @brief Join the capture of a sink, starting it if no other session streams it with the same parameters.
+   * @return The capture, or `nullptr` if the microphone couldn't be opened.
+   */
+  std::shared_ptr<fan_out_t> subscribe(const audio_ctx_ref_t &ref, const config_t &config, const std::string &sink, void *channel_data) {
+    auto fan_out = std::make_shared<fan_out_t>(ref, config);
+    auto key = fan_out_key(sink, config, fan_out->stream);
+
+    std::lock_guard lg {fan_outs_lock};
+
+    std::erase_if(fan_outs, [](const auto &el) {
+      return el.second.expired();
+    });
+
+    auto it = fan_outs.find(key);
+    auto running = it == std::end(fan_outs) ? nullptr : it->second.lock();
+    if (running && !running->stop_event.peek()) {
+      BOOST_LOG(info) << "Sharing the running audio capture of "sv << sink;
+
+      running->subscribe(channel_data);
+      return running;
+    }
+
+    auto &stream = fan_out->stream;
+    fan_out->mic = ref->control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, fan_out->frame_size());
+    if (!fan_out->mic) {
+      return nullptr;
+    }
+
+    fan_out->subscribe(channel_data);
+    fan_out->encode_thread = std::thread {encodeThread, std::ref(*fan_out)};
+    fan_out->capture_thread = std::thread {captureThread, std::ref(*fan_out)};
+    fan_outs.insert_or_assign(std::move(key), fan_out);
+
+    return fan_out;
+  }
+
   void capture(safe::mail_t mail, config_t config, void *channel_data) {
     auto shutdown_event = mail->event<bool>(mail::shutdown);
 
@@ -198,59 +394,18 @@ namespace audio {
       }
     }
 
-    auto frame_size = config.packetDuration * stream.sampleRate / 1000;
-    auto mic = control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, frame_size);
-    if (!mic) {
+    auto fan_out = subscribe(ref, config, *sink, channel_data);
+    if (!fan_out) {
       return;
     }
 
     // Audio is initialized, so we don't want to print the failure message
     init_failure_fg.disable();
 
-    // Capture takes place on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::critical);
-
-    auto samples = std::make_shared<sample_queue_t::element_type>(30);
-    std::thread thread {encodeThread, samples, config, channel_data};
+    shutdown_event->view();
 
-    auto fg = util::fail_guard([&]() {
-      samples->stop();
-      thread.join();
-
-      shutdown_event->view();
-    });
-
-    int samples_per_frame = frame_size * stream.channelCount;
-
-    while (!shutdown_event->peek()) {
-      std::vector<float> sample_buffer;
-      sample_buffer.resize(samples_per_frame);
-
-      auto status = mic->sample(sample_buffer);
-      switch (status) {
-        case platf::capture_e::ok:
-          break;
-        case platf::capture_e::timeout:
-          continue;
-        case platf::capture_e::reinit:
-          if (config::audio.auto_capture) {
-            BOOST_LOG(info) << "Reinitializing audio capture"sv;
-            mic.reset();
-            do {
-              mic = control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, frame_size);
-              if (!mic) {
-                BOOST_LOG(warning) << "Couldn't re-initialize audio input"sv;
-              }
-            } while (!mic && !shutdown_event->view(5s));
-          }
-
-          continue;
-        default:
-          return;
-      }
-
-      samples->raise(std::move(sample_buffer));
-    }
+    // The last session to leave stops the capture
+    fan_out->unsubscribe(channel_data);
   }
 
   audio_ctx_ref_t get_audio_ctx_ref() {
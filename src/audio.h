@@ -4,6 +4,13 @@
  */
 #pragma once
 
+// standard includes
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
 // local includes
 #include "platform/common.h"
 #include "thread_safe.h"
@@ -77,6 +84,61 @@ namespace audio {
   using packet_t = std::pair<void *, buffer_t>;
   using audio_ctx_ref_t = safe::shared_t<audio_ctx_t>::ptr_t;
 
+  /**
+   * @brief Buffers handed back by their consumer, so the audio threads don't allocate for every frame.
+   */
+  template<class T>
+  class buffer_pool_t {
+  public:
+    /**
+     * @param capacity The number of idle buffers to keep, any more are freed.
+     */
+    explicit buffer_pool_t(std::size_t capacity):
+        _capacity {capacity} {
+      _idle.reserve(capacity);
+    }
+
+    /**
+     * @brief Take an idle buffer.
+     * @return The buffer, or `std::nullopt` if the caller has to allocate a new one.
+     */
+    std::optional<T> take() {
+      std::lock_guard lg {_lock};
+
+      if (_idle.empty()) {
+        ++allocated;
+        return std::nullopt;
+      }
+
+      ++reused;
+      auto buffer = std::move(_idle.back());
+      _idle.pop_back();
+
+      return buffer;
+    }
+
+    void give(T &&buffer) {
+      std::lock_guard lg {_lock};
+
+      if (_idle.size() < _capacity) {
+        _idle.emplace_back(std::move(buffer));
+      }
+    }
+
+    std::atomic_uint64_t allocated {0};
+    std::atomic_uint64_t reused {0};
+
+  private:
+    std::mutex _lock;
+    std::size_t _capacity;
+    std::vector<T> _idle;
+  };
+
+  /**
+   * @brief Opus packets, returned by the broadcast thread once they are copied into their shard.
+   */
+  buffer_pool_t<buffer_t> &packet_pool();
+
   void capture(safe::mail_t mail, config_t config, void *channel_data);
 
   /**
@@ -500,6 +500,7 @@ namespace config {
     {},  // encoder
     {},  // adapter_name
     {},  // output_name
+    "encoder_cache.json"s,  // encoder_cache_file
 
     {
       video_t::dd_t::config_option_e::disabled,  // configuration_option
@@ -515,6 +516,7 @@ namespace config {
     },  // display_device
 
     1,  // min_fps_factor
+    0ms,  // warm_session_timeout
     0,  // max_bitrate
 
     "1920x1080x60",  // fallback_mode
@@ -592,6 +594,7 @@ namespace config {
     47989,  // Base port number
     "ipv4",  // Address family
     platf::appdata().string() + "/sunshine.log",  // log file
+    std::chrono::milliseconds {250},  // log_flush_interval
     false,  // notify_pre_releases
     {},  // prep commands
     {},  // server commands
@@ -1167,6 +1170,7 @@ namespace config {
     string_f(vars, "encoder", video.encoder);
     string_f(vars, "adapter_name", video.adapter_name);
     string_f(vars, "output_name", video.output_name);
+    path_f(vars, "file_encoder_cache", video.encoder_cache_file);
 
     generic_f(vars, "dd_configuration_option", video.dd.configuration_option, dd::config_option_from_view);
     generic_f(vars, "dd_resolution_option", video.dd.resolution_option, dd::resolution_option_from_view);
@@ -1186,6 +1190,13 @@ namespace config {
     bool_f(vars, "dd_wa_hdr_toggle", video.dd.wa.hdr_toggle);
 
     int_between_f(vars, "min_fps_factor", video.min_fps_factor, {1, 3});
+    {
+      int value = -1;
+      int_between_f(vars, "warm_session_timeout", value, {0, std::numeric_limits<int>::max()});
+      if (value >= 0) {
+        video.warm_session_timeout = std::chrono::milliseconds {value};
+      }
+    }
     int_f(vars, "max_bitrate", video.max_bitrate);
     string_f(vars, "fallback_mode", video.fallback_mode);
 
@@ -1193,6 +1204,13 @@ namespace config {
     path_f(vars, "cert", nvhttp.cert);
     string_f(vars, "sunshine_name", nvhttp.sunshine_name);
     path_f(vars, "log_path", config::sunshine.log_file);
+    {
+      int value = -1;
+      int_between_f(vars, "log_flush_interval", value, {0, 10000});
+      if (value >= 0) {
+        config::sunshine.log_flush_interval = std::chrono::milliseconds {value};
+      }
+    }
     path_f(vars, "file_state", nvhttp.file_state);
 
     // Must be run after "file_state"
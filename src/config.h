@@ -84,6 +84,7 @@ namespace config {
     std::string encoder;
     std::string adapter_name;
     std::string output_name;
+    std::string encoder_cache_file;  ///< Where validated encoder capabilities are persisted
 
     struct dd_t {
       struct workarounds_t {
@@ -141,6 +142,7 @@ namespace config {
     } dd;
 
     int min_fps_factor;  // Minimum fps target, determines minimum frame time
+    std::chrono::milliseconds warm_session_timeout;  ///< How long an idle encode session is kept for the next stream, 0 disables it
     int max_bitrate;  // Maximum bitrate, sets ceiling in kbps for bitrate requested from client
 
     std::string fallback_mode;
@@ -272,6 +274,7 @@ namespace config {
     std::string address_family;
 
     std::string log_file;
+    std::chrono::milliseconds log_flush_interval;
     bool notify_pre_releases;
     std::vector<prep_cmd_t> prep_cmds;
     std::vector<server_cmd_t> server_cmds;
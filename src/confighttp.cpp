@@ -7,6 +7,7 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <atomic>
 #include <filesystem>
 #include <fstream>
 #include <set>
@@ -24,6 +25,7 @@
 #include <Simple-Web-Server/server_https.hpp>
 
 // local includes
+#include "asset_cache.h"
 #include "config.h"
 #include "confighttp.h"
 #include "crypto.h"
@@ -60,6 +62,18 @@ namespace confighttp {
   std::string sessionCookie;
   static std::chrono::time_point<std::chrono::steady_clock> cookie_creation_time;
 
+  // Limits of incremental log reads
+  constexpr std::size_t MAX_LOG_CHUNK_SIZE = 4 * 1024 * 1024;
+  constexpr auto MAX_LOG_WAIT = 30s;
+
+  // Long-polling log requests each wait on a thread of their own, so only a few may wait at once
+  constexpr int MAX_LOG_WAITERS = 4;
+  constexpr auto LOG_WAIT_SLICE = 500ms;
+  std::atomic_int log_waiters;
+
+  // Everything under WEB_DIR, loaded once when the server starts
+  asset_cache::cache_t web_assets;
+
   /**
    * @brief Log the request details.
    * @param request The HTTP request object.
@@ -234,6 +248,23 @@ namespace confighttp {
     response->write(code, tree.dump(), headers);
   }
 
+  /**
+   * @brief Send an asset from the web asset cache.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * @param path The path of the asset, relative to WEB_DIR.
+   * @param headers Additional response headers.
+   */
+  void send_asset(resp_https_t response, req_https_t request, const std::string &path, const SimpleWeb::CaseInsensitiveMultimap &headers = {}) {
+    auto asset = web_assets.find(path);
+    if (!asset) {
+      not_found(response, request);
+      return;
+    }
+
+    asset_cache::write(response, request, *asset, headers);
+  }
+
   /**
    * @brief Get the index page.
    * @param response The HTTP response object.
@@ -246,11 +277,10 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "index.html");
     SimpleWeb::CaseInsensitiveMultimap headers {
       {"Content-Type", "text/html; charset=utf-8"}
     };
-    response->write(content, headers);
+    send_asset(response, request, "index.html", headers);
   }
 
   /**
@@ -265,11 +295,10 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "pin.html");
     SimpleWeb::CaseInsensitiveMultimap headers {
       {"Content-Type", "text/html; charset=utf-8"}
     };
-    response->write(content, headers);
+    send_asset(response, request, "pin.html", headers);
   }
 
   /**
@@ -284,12 +313,11 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "apps.html");
     SimpleWeb::CaseInsensitiveMultimap headers {
       {"Content-Type", "text/html; charset=utf-8"},
       {"Access-Control-Allow-Origin", "https://images.igdb.com/"}
     };
-    response->write(content, headers);
+    send_asset(response, request, "apps.html", headers);
   }
 
   /**
@@ -304,11 +332,10 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "clients.html");
     SimpleWeb::CaseInsensitiveMultimap headers {
       {"Content-Type", "text/html; charset=utf-8"}
     };
-    response->write(content, headers);
+    send_asset(response, request, "clients.html", headers);
   }
 
   /**
@@ -323,11 +350,10 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "config.html");
     SimpleWeb::CaseInsensitiveMultimap headers {
       {"Content-Type", "text/html; charset=utf-8"}
     };
-    response->write(content, headers);
+    send_asset(response, request, "config.html", headers);
   }
 
   /**
@@ -342,11 +368,10 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "password.html");
     SimpleWeb::CaseInsensitiveMultimap headers {
       {"Content-Type", "text/html; charset=utf-8"}
     };
-    response->write(content, headers);
+    send_asset(response, request, "password.html", headers);
   }
 
   /**
@@ -366,11 +391,10 @@ namespace confighttp {
       return;
     }
 
-    std::string content = file_handler::read_file(WEB_DIR "login.html");
     SimpleWeb::CaseInsensitiveMultimap headers {
       {"Content-Type", "text/html; charset=utf-8"}
     };
-    response->write(content, headers);
+    send_asset(response, request, "login.html", headers);
   }
 
   /**
@@ -386,11 +410,10 @@ namespace confighttp {
       return;
     }
 
-    std::string content = file_handler::read_file(WEB_DIR "welcome.html");
     SimpleWeb::CaseInsensitiveMultimap headers {
       {"Content-Type", "text/html; charset=utf-8"}
     };
-    response->write(content, headers);
+    send_asset(response, request, "welcome.html", headers);
   }
 
   /**
@@ -405,11 +428,10 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "troubleshooting.html");
     SimpleWeb::CaseInsensitiveMultimap headers {
       {"Content-Type", "text/html; charset=utf-8"}
     };
-    response->write(content, headers);
+    send_asset(response, request, "troubleshooting.html", headers);
   }
 
   /**
@@ -420,11 +442,7 @@ namespace confighttp {
   void getFaviconImage(resp_https_t response, req_https_t request) {
     print_req(request);
 
-    std::ifstream in(WEB_DIR "images/sunshine.ico", std::ios::binary);
-    SimpleWeb::CaseInsensitiveMultimap headers {
-      {"Content-Type", "image/x-icon"}
-    };
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    send_asset(response, request, "images/sunshine.ico");
   }
 
   /**
@@ -438,22 +456,7 @@ namespace confighttp {
   void getApolloLogoImage(resp_https_t response, req_https_t request) {
     print_req(request);
 
-    std::ifstream in(WEB_DIR "images/logo-apollo-45.png", std::ios::binary);
-    SimpleWeb::CaseInsensitiveMultimap headers {
-      {"Content-Type", "image/png"}
-    };
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
-  }
-
-  /**
-   * @brief Check if a path is a child of another path.
-   * @param base The base path.
-   * @param query The path to check.
-   * @return True if the path is a child of the base path, false otherwise.
-   */
-  bool isChildPath(fs::path const &base, fs::path const &query) {
-    auto relPath = fs::relative(base, query);
-    return *(relPath.begin()) != fs::path("..");
+    send_asset(response, request, "images/logo-apollo-45.png");
   }
 
   /**
@@ -464,36 +467,17 @@ namespace confighttp {
   void getNodeModules(resp_https_t response, req_https_t request) {
     print_req(request);
 
-    fs::path webDirPath(WEB_DIR);
-    fs::path nodeModulesPath(webDirPath / "assets");
-
     // .relative_path is needed to shed any leading slash that might exist in the request path
-    auto filePath = fs::weakly_canonical(webDirPath / fs::path(request->path).relative_path());
+    auto filePath = fs::path(request->path).relative_path().lexically_normal().generic_string();
 
-    // Don't do anything if file does not exist or is outside the assets directory
-    if (!isChildPath(filePath, nodeModulesPath)) {
+    // Only files loaded from the assets directory may be served from here
+    if (!filePath.starts_with("assets/")) {
       BOOST_LOG(warning) << "Someone requested a path " << filePath << " that is outside the assets folder";
       bad_request(response, request);
       return;
     }
 
-    if (!fs::exists(filePath)) {
-      not_found(response, request);
-      return;
-    }
-
-    auto relPath = fs::relative(filePath, webDirPath);
-    // get the mime type from the file extension mime_types map
-    // remove the leading period from the extension
-    auto mimeType = mime_types.find(relPath.extension().string().substr(1));
-    if (mimeType == mime_types.end()) {
-      bad_request(response, request);
-      return;
-    }
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", mimeType->second);
-    std::ifstream in(filePath.string(), std::ios::binary);
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    send_asset(response, request, filePath);
   }
 
   /**
@@ -931,7 +915,20 @@ namespace confighttp {
    * @param response The HTTP response object.
    * @param request The HTTP request object.
    *
+   * Without query parameters, the whole log file is returned. To follow the log incrementally, pass:
+   * - `offset`: Byte offset to read from, the `X-Log-Offset` header of the previous response.
+   * - `id`: Optional, the `X-Log-Id` header of the previous response. Reading restarts at 0 if the log was replaced since.
+   * - `wait`: Optional, seconds to wait for new output if there is none yet (at most 30).
+   *   While 4 other requests are waiting already, the response is sent right away.
+   *
+   * Incremental responses carry at most 4 MiB of log output and the following headers:
+   * - `X-Log-Id`: Identifies the log file, it changes when Apollo restarts.
+   * - `X-Log-Begin`: Offset of the first byte returned.
+   * - `X-Log-Offset`: Offset to pass in the next request.
+   * - `X-Log-Size`: Current size of the log, more output is pending if it's larger than `X-Log-Offset`.
+   *
    * @api_examples{/api/logs| GET| null}
+   * @api_examples{/api/logs?offset=0&wait=25| GET| null}
    */
   void getLogs(resp_https_t response, req_https_t request) {
     if (!authenticate(response, request)) {
@@ -939,10 +936,83 @@ namespace confighttp {
     }
 
     print_req(request);
-    std::string content = file_handler::read_file(config::sunshine.log_file.c_str());
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/plain");
-    response->write(SimpleWeb::StatusCode::success_ok, content, headers);
+
+    auto args = request->parse_query_string();
+    auto offset_it = args.find("offset");
+    auto tail = logging::get_log_tail();
+    if (offset_it == std::end(args) || !tail) {
+      std::string content = file_handler::read_file(config::sunshine.log_file.c_str());
+      SimpleWeb::CaseInsensitiveMultimap headers;
+      headers.emplace("Content-Type", "text/plain");
+      response->write(SimpleWeb::StatusCode::success_ok, content, headers);
+      return;
+    }
+
+    std::uint64_t offset;
+    std::chrono::seconds wait {0};
+    try {
+      offset = std::stoull(offset_it->second);
+      if (auto it = args.find("wait"); it != std::end(args)) {
+        wait = std::clamp(std::chrono::seconds {std::stoi(it->second)}, 0s, MAX_LOG_WAIT);
+      }
+    } catch (std::exception &e) {
+      bad_request(response, request, e.what());
+      return;
+    }
+
+    // The log file was replaced since the previous read
+    auto id_it = args.find("id");
+    if ((id_it != std::end(args) && id_it->second != tail->id) || offset > tail->end_offset()) {
+      offset = 0;
+    }
+
+    auto send_chunk = [response, offset]() {
+      auto chunk = logging::read_log(offset, MAX_LOG_CHUNK_SIZE);
+
+      SimpleWeb::CaseInsensitiveMultimap headers;
+      headers.emplace("Content-Type", "text/plain");
+      headers.emplace("X-Log-Id", chunk.id);
+      headers.emplace("X-Log-Begin", std::to_string(chunk.begin));
+      headers.emplace("X-Log-Offset", std::to_string(chunk.end));
+      headers.emplace("X-Log-Size", std::to_string(chunk.size));
+      response->write(SimpleWeb::StatusCode::success_ok, chunk.data, headers);
+    };
+
+    if (wait > 0s && tail->end_offset() == offset) {
+      if (log_waiters.fetch_add(1) >= MAX_LOG_WAITERS) {
+        --log_waiters;
+        send_chunk();
+        return;
+      }
+
+      // Long polling, the response is sent once the thread lets go of it
+      std::thread {[tail, offset, wait, send_chunk]() mutable {
+        auto fg = util::fail_guard([]() {
+          --log_waiters;
+          log_waiters.notify_all();
+        });
+
+        // Destroyed before the guard runs, so the response doesn't outlive the server either
+        auto send = std::move(send_chunk);
+
+        // Wake up now and then, so a waiter never outlives the server
+        auto shutdown_event = mail::man->event<bool>(mail::shutdown);
+        auto deadline = std::chrono::steady_clock::now() + wait;
+        for (auto now = std::chrono::steady_clock::now(); now < deadline && !shutdown_event->peek(); now = std::chrono::steady_clock::now()) {
+          if (tail->wait_for(offset, std::min(std::chrono::ceil<std::chrono::milliseconds>(deadline - now), std::chrono::milliseconds {LOG_WAIT_SLICE}))) {
+            break;
+          }
+        }
+
+        if (!shutdown_event->peek()) {
+          send();
+        }
+      }}.detach();
+
+      return;
+    }
+
+    send_chunk();
   }
 
   /**
@@ -1283,6 +1353,9 @@ namespace confighttp {
     auto shutdown_event = mail::man->event<bool>(mail::shutdown);
     auto port_https = net::map_port(PORT_HTTPS);
     auto address_family = net::af_from_enum_string(config::sunshine.address_family);
+    auto assets_loaded = web_assets.load_directory(WEB_DIR, mime_types);
+    BOOST_LOG(debug) << "Loaded "sv << assets_loaded << " web assets ("sv << web_assets.size_bytes() / 1024 << " KiB)"sv;
+
     https_server_t server { config::nvhttp.cert, config::nvhttp.pkey };
     server.default_resource["DELETE"] = [](resp_https_t response, req_https_t request) {
       bad_request(response, request);
@@ -1356,5 +1429,10 @@ namespace confighttp {
     server.stop();
 
     tcp.join();
+
+    // Log waiters notice the shutdown within LOG_WAIT_SLICE
+    for (auto waiters = log_waiters.load(); waiters > 0; waiters = log_waiters.load()) {
+      log_waiters.wait(waiters);
+    }
   }
 }  // namespace confighttp
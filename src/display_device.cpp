@@ -19,6 +19,7 @@
 #include "audio.h"
 #include "platform/common.h"
 #include "rtsp.h"
+#include "video.h"
 
 // platform-specific includes
 #ifdef _WIN32
@@ -38,8 +39,20 @@ namespace display_device {
       std::mutex mutex {};
       std::chrono::milliseconds config_revert_delay {0};
       std::unique_ptr<RetryScheduler<SettingsManagerInterface>> sm_instance {nullptr};
+      std::optional<SingleDisplayConfiguration> last_configuration {};  ///< Kept across reverts, a warm encode session may have been created in it
     } DD_DATA;
 
+    /**
+     * @brief Check whether two configurations put the display in the same state.
+     */
+    bool same_configuration(const SingleDisplayConfiguration &lhs, const SingleDisplayConfiguration &rhs) {
+      return lhs.m_device_id == rhs.m_device_id &&
+             lhs.m_device_prep == rhs.m_device_prep &&
+             lhs.m_resolution == rhs.m_resolution &&
+             lhs.m_refresh_rate == rhs.m_refresh_rate &&
+             lhs.m_hdr_state == rhs.m_hdr_state;
+    }
+
     /**
      * @brief Helper class for capturing audio context when the API demands it.
      *
@@ -713,6 +726,7 @@ namespace display_device {
     }
     DD_DATA.config_revert_delay = video_config.dd.config_revert_delay;
     DD_DATA.sm_instance = nullptr;
+    DD_DATA.last_configuration = std::nullopt;
 
     // If we fail to create settings manager, this means platform is not supported, and
     // we will need to provided error-free pass-trough in other methods
@@ -788,6 +802,15 @@ namespace display_device {
     }
 
     if (const auto *disabled {std::get_if<configuration_disabled_tag_t>(&result)}; disabled) {
+      {
+        std::lock_guard lock {DD_DATA.mutex};
+        if (DD_DATA.last_configuration) {
+          // The stream runs in the reverted mode, not in the one a warm encode session was created in
+          DD_DATA.last_configuration = std::nullopt;
+          video::retire_warm_session();
+        }
+      }
+
       revert_configuration();
       return;
     }
@@ -803,6 +826,13 @@ namespace display_device {
       return;
     }
 
+    // A warm encode session can only be adopted in the display mode it was created in. Reverting in
+    // between (e.g. when the stream ended) is fine, applying the same configuration restores that mode.
+    if (!DD_DATA.last_configuration || !same_configuration(*DD_DATA.last_configuration, config)) {
+      video::retire_warm_session();
+      DD_DATA.last_configuration = config;
+    }
+
     DD_DATA.sm_instance->schedule([config](auto &settings_iface, auto &stop_token) {
       // We only want to keep retrying in case of a transient errors.
       // In other cases, when we either fail or succeed we just want to stop...
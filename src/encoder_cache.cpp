@@ -0,0 +1,103 @@
+/**
+ * @file src/encoder_cache.cpp
+ * @brief Definitions for the on-disk cache of encoder capabilities.
+ */
+// standard includes
+#include <fstream>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+// local includes
+#include "encoder_cache.h"
+#include "logging.h"
+
+using namespace std::literals;
+
+namespace encoder_cache {
+  namespace fs = std::filesystem;
+
+  cache_t::cache_t(std::string key):
+      _key {std::move(key)} {
+  }
+
+  cache_t cache_t::load(const fs::path &file, const std::string &key) {
+    cache_t cache {key};
+
+    std::ifstream in(file);
+    if (!in) {
+      return cache;
+    }
+
+    try {
+      auto root = nlohmann::json::parse(in);
+      if (root.at("key").get<std::string>() != key) {
+        BOOST_LOG(info) << "Encoder capability cache is out of date"sv;
+        return cache;
+      }
+
+      for (auto &[name, node] : root.at("encoders").items()) {
+        cache._entries.insert_or_assign(name, entry_t {
+                                                node.at("passed").get<bool>(),
+                                                node.at("capabilities").get<std::array<std::uint64_t, 3>>(),
+                                              });
+      }
+    } catch (const std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't read encoder capability cache "sv << file << ": "sv << e.what();
+      cache._entries.clear();
+    }
+
+    return cache;
+  }
+
+  bool cache_t::save(const fs::path &file) const {
+    nlohmann::json encoders = nlohmann::json::object();
+    for (auto &[name, entry] : _entries) {
+      encoders[name] = {
+        {"passed", entry.passed},
+        {"capabilities", entry.capabilities},
+      };
+    }
+
+    nlohmann::json root {
+      {"key", _key},
+      {"encoders", std::move(encoders)},
+    };
+
+    // Write next to the cache first, so a crash never leaves a truncated file behind
+    auto temp_file = file;
+    temp_file += ".tmp";
+    {
+      std::ofstream out(temp_file, std::ios::trunc);
+      out << root.dump(2);
+      if (!out.flush()) {
+        BOOST_LOG(warning) << "Couldn't write encoder capability cache "sv << temp_file;
+        return false;
+      }
+    }
+
+    std::error_code ec;
+    fs::rename(temp_file, file, ec);
+    if (ec) {
+      BOOST_LOG(warning) << "Couldn't replace encoder capability cache "sv << file << ": "sv << ec.message();
+      fs::remove(temp_file, ec);
+      return false;
+    }
+
+    return true;
+  }
+
+  const entry_t *cache_t::find(const std::string_view &encoder) const {
+    auto it = _entries.find(encoder);
+    if (it == std::end(_entries)) {
+      return nullptr;
+    }
+
+    return &it->second;
+  }
+
+  void cache_t::insert(const std::string_view &encoder, entry_t entry) {
+    entry.verified = true;
+    _entries.insert_or_assign(std::string {encoder}, entry);
+  }
+}  // namespace encoder_cache
@@ -0,0 +1,77 @@
+/**
+ * @file src/encoder_cache.h
+ * @brief Declarations for the on-disk cache of encoder capabilities.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Results of encoder validation, persisted so they don't have to be probed on every start.
+ */
+namespace encoder_cache {
+
+  struct entry_t {
+    bool passed;  ///< Whether the encoder passed validation at all
+    std::array<std::uint64_t, 3> capabilities;  ///< Capability bits for H.264, HEVC and AV1
+    bool verified = false;  ///< Whether the results were validated by this process rather than loaded from disk
+  };
+
+  class cache_t {
+  public:
+    cache_t() = default;
+
+    /**
+     * @brief Create an empty cache.
+     * @param key Identifies the environment the results are valid for.
+     */
+    explicit cache_t(std::string key);
+
+    /**
+     * @brief Load a cache from a file.
+     * @param file The cache file.
+     * @param key The key of the current environment.
+     * @return The cached results, or an empty cache if the file is missing, invalid or was written for another key.
+     */
+    static cache_t load(const std::filesystem::path &file, const std::string &key);
+
+    /**
+     * @brief Write the cache to a file.
+     * @param file The cache file.
+     * @return `true` on success.
+     */
+    bool save(const std::filesystem::path &file) const;
+
+    /**
+     * @brief Find the cached results of an encoder.
+     * @param encoder The name of the encoder.
+     * @return The cached results, or `nullptr` if the encoder wasn't validated.
+     */
+    const entry_t *find(const std::string_view &encoder) const;
+
+    /**
+     * @brief Store the results of an encoder that was just validated.
+     * @param encoder The name of the encoder.
+     * @param entry The validation results, stored as verified.
+     */
+    void insert(const std::string_view &encoder, entry_t entry);
+
+    const std::string &key() const {
+      return _key;
+    }
+
+    bool empty() const {
+      return _entries.empty();
+    }
+
+  private:
+    std::string _key;
+    std::map<std::string, entry_t, std::less<>> _entries;
+  };
+}  // namespace encoder_cache
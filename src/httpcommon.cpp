@@ -6,6 +6,7 @@
 
 // standard includes
 #include <filesystem>
+#include <fstream>
 #include <utility>
 
 // lib includes
@@ -42,6 +43,7 @@ namespace http {
   std::string unique_id;
   uuid_util::uuid_t uuid;
   net::net_e origin_web_ui_allowed;
+  std::recursive_mutex state_file_lock;
 
   int init() {
     bool clean_slate = config::sunshine.flags[config::flag::FRESH_STATE];
@@ -68,30 +70,67 @@ namespace http {
   }
 
   int save_user_creds(const std::string &file, const std::string &username, const std::string &password, bool run_our_mouth) {
-    pt::ptree outputTree;
+    auto salt = crypto::rand_alphabet(16);
+
+    // The credentials share the state file with the paired clients by default
+    auto written = update_json_file(file, [&](nlohmann::json &root) {
+      root["username"] = username;
+      root["salt"] = salt;
+      root["password"] = util::hex(crypto::hash(password + salt)).to_string();
+
+      return true;
+    });
+    if (!written) {
+      BOOST_LOG(error) << "error writing to the credentials file, perhaps try this again as an administrator?"sv;
+      return -1;
+    }
 
+    BOOST_LOG(info) << "New credentials have been created"sv;
+    return 0;
+  }
+
+  bool update_json_file(const std::string &file, const std::function<bool(nlohmann::json &)> &update) {
+    std::lock_guard lg {state_file_lock};
+
+    nlohmann::json root = nlohmann::json::object();
+    // If the file exists, try to read it.
     if (fs::exists(file)) {
       try {
-        pt::read_json(file, outputTree);
+        std::ifstream in(file);
+        in >> root;
       } catch (std::exception &e) {
-        BOOST_LOG(error) << "Couldn't read user credentials: "sv << e.what();
-        return -1;
+        BOOST_LOG(error) << "Couldn't read "sv << file << ": "sv << e.what();
+        return false;
       }
     }
 
-    auto salt = crypto::rand_alphabet(16);
-    outputTree.put("username", username);
-    outputTree.put("salt", salt);
-    outputTree.put("password", util::hex(crypto::hash(password + salt)).to_string());
+    if (!update(root)) {
+      return false;
+    }
+
+    // Write next to the file first, so a crash never leaves a truncated file behind
+    auto temp_file = file + ".tmp";
     try {
-      pt::write_json(file, outputTree);
+      std::ofstream out(temp_file, std::ios::trunc);
+      out << root.dump(4);  // Pretty-print with an indent of 4 spaces.
+      if (!out.flush()) {
+        BOOST_LOG(error) << "Couldn't write "sv << temp_file;
+        return false;
+      }
     } catch (std::exception &e) {
-      BOOST_LOG(error) << "error writing to the credentials file, perhaps try this again as an administrator? Details: "sv << e.what();
-      return -1;
+      BOOST_LOG(error) << "Couldn't write "sv << temp_file << ": "sv << e.what();
+      return false;
     }
 
-    BOOST_LOG(info) << "New credentials have been created"sv;
-    return 0;
+    std::error_code ec;
+    fs::rename(temp_file, file, ec);
+    if (ec) {
+      BOOST_LOG(error) << "Couldn't replace "sv << file << ": "sv << ec.message();
+      fs::remove(temp_file, ec);
+      return false;
+    }
+
+    return true;
   }
 
   bool user_creds_exist(const std::string &file) {
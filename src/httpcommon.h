@@ -4,8 +4,14 @@
  */
 #pragma once
 
+// standard includes
+#include <functional>
+#include <mutex>
+#include <string>
+
 // lib includes
 #include <curl/curl.h>
+#include <nlohmann/json.hpp>
 
 // local includes
 #include "network.h"
@@ -28,8 +34,19 @@ namespace http {
   std::string url_escape(const std::string &url);
   std::string url_get_host(const std::string &url);
 
+  /**
+   * @brief Change a JSON file under `state_file_lock`.
+   * @details The state file also holds the Web UI credentials by default, so all writers go through here.
+   *          The file is replaced atomically.
+   * @param file The file to change.
+   * @param update Changes the contents, an empty object if the file doesn't exist. Returns `false` to leave the file as is.
+   * @return `true` if the file was written.
+   */
+  bool update_json_file(const std::string &file, const std::function<bool(nlohmann::json &)> &update);
+
   extern std::string unique_id;
   extern uuid_util::uuid_t uuid;
   extern net::net_e origin_web_ui_allowed;
+  extern std::recursive_mutex state_file_lock;  ///< Serializes every writer of the state file, including the Web UI credentials
 
 }  // namespace http
@@ -1520,7 +1520,9 @@ namespace input {
     }
 
     // Print the final input packet
-    input::print((void *) payload);
+    if (logging::enabled(debug)) {
+      input::print((void *) payload);
+    }
 
     // Send the batched input to the OS
     switch (util::endian::little(payload->magic)) {
@@ -7,8 +7,10 @@
 #include <filesystem>
 #include <iomanip>
 #include <iostream>
+#include <thread>
 
 // lib includes
+#include <boost/algorithm/string/replace.hpp>
 #include <boost/core/null_deleter.hpp>
 #include <boost/format.hpp>
 #include <boost/log/attributes/clock.hpp>
@@ -29,7 +31,15 @@ using namespace std::literals;
 
 namespace bl = boost::log;
 
-boost::shared_ptr<boost::log::sinks::asynchronous_sink<boost::log::sinks::text_ostream_backend>> sink;
+namespace logging {
+  class batch_backend_t;
+}  // namespace logging
+
+using text_sink = bl::sinks::asynchronous_sink<logging::batch_backend_t>;
+
+boost::shared_ptr<text_sink> sink;
+std::shared_ptr<logging::log_tail_t> log_tail;
+std::string log_path;
 
 bl::sources::severity_logger<int> verbose(0);  // Dominating output
 bl::sources::severity_logger<int> debug(1);  // Follow what is happening
@@ -44,11 +54,239 @@ bl::sources::severity_logger<int> tests(10);  // Automatic tests output
 BOOST_LOG_ATTRIBUTE_KEYWORD(severity, "Severity", int)
 
 namespace logging {
+  std::atomic<int> min_level {0};
+
+  // Enough to answer the troubleshooting page polls from memory, even with verbose logging
+  constexpr std::size_t LOG_TAIL_CAPACITY = 4 * 1024 * 1024;
+
+  // Batches larger than this are written out without waiting for the flush interval
+  constexpr std::size_t MAX_BATCH_SIZE = 64 * 1024;
+
+  // Wakes up the sink periodically so batched records don't linger while the log is quiet
+  std::thread flush_thread;
+  std::mutex flush_lock;
+  std::condition_variable flush_cv;
+  bool flush_stop;
+
+  /**
+   * @brief Sink backend that writes formatted records to its streams in batches.
+   * @details Records are collected in memory and written out with a single write and flush per stream
+   *          once the flush interval elapsed, the batch grew large, or a warning or worse was logged.
+   *          Formatting and writing both happen on the dedicated thread of the asynchronous sink.
+   */
+  class batch_backend_t: public bl::sinks::basic_formatted_sink_backend<char, bl::sinks::combine_requirements<bl::sinks::synchronized_feeding, bl::sinks::flushing>::type> {
+  public:
+    explicit batch_backend_t(std::chrono::milliseconds flush_interval):
+        _flush_interval {flush_interval},
+        _last_flush {std::chrono::steady_clock::now()} {
+    }
+
+    void add_stream(boost::shared_ptr<std::ostream> stream) {
+      _streams.emplace_back(std::move(stream));
+    }
+
+    void consume(const bl::record_view &view, const string_type &formatted) {
+      _batch.append(formatted);
+      _batch.push_back('\n');
+
+      auto log_level = view.attribute_values()["Severity"].extract<int>().get();
+      if (
+        log_level >= 3 ||
+        _batch.size() >= MAX_BATCH_SIZE ||
+        std::chrono::steady_clock::now() - _last_flush >= _flush_interval
+      ) {
+        flush();
+      }
+    }
+
+    void flush() {
+      _last_flush = std::chrono::steady_clock::now();
+      if (_batch.empty()) {
+        return;
+      }
+
+      for (auto &stream : _streams) {
+        stream->write(_batch.data(), (std::streamsize) _batch.size());
+        stream->flush();
+      }
+      _batch.clear();
+    }
+
+  private:
+    std::chrono::milliseconds _flush_interval;
+    std::chrono::steady_clock::time_point _last_flush;
+
+    std::vector<boost::shared_ptr<std::ostream>> _streams;
+    std::string _batch;
+  };
+
+  /**
+   * @brief Stream buffer that forwards the log output to the log tail.
+   * @details The sink backend only flushes after complete records, so only complete records are forwarded.
+   */
+  class log_tail_buf_t: public std::streambuf {
+  public:
+    explicit log_tail_buf_t(std::shared_ptr<log_tail_t> tail):
+        _tail {std::move(tail)} {
+    }
+
+  protected:
+    int_type overflow(int_type ch) override {
+      if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        _pending.push_back(traits_type::to_char_type(ch));
+      }
+
+      return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char *data, std::streamsize size) override {
+      _pending.append(data, size);
+      return size;
+    }
+
+    int sync() override {
+      if (_pending.empty()) {
+        return 0;
+      }
+
+#ifdef _WIN32
+      // The log file is written in text mode, mirror its line endings to keep offsets in sync
+      boost::replace_all(_pending, "\n", "\r\n");
+#endif
+      _tail->append(_pending);
+      _pending.clear();
+
+      return 0;
+    }
+
+  private:
+    std::shared_ptr<log_tail_t> _tail;
+    std::string _pending;
+  };
+
+  class log_tail_stream_t: public std::ostream {
+  public:
+    explicit log_tail_stream_t(std::shared_ptr<log_tail_t> tail):
+        std::ostream {nullptr},
+        _buf {std::move(tail)} {
+      rdbuf(&_buf);
+    }
+
+  private:
+    log_tail_buf_t _buf;
+  };
+
+  log_tail_t::log_tail_t(std::size_t capacity):
+      id {std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count())},
+      _buffer(capacity, '\0'),
+      _end {0} {
+  }
+
+  void log_tail_t::append(const std::string_view &data) {
+    {
+      std::lock_guard lg {_lock};
+
+      auto capacity = _buffer.size();
+
+      // Only the last capacity bytes can ever be read back
+      auto skip = data.size() > capacity ? data.size() - capacity : 0;
+      _end += skip;
+
+      for (auto pos = skip; pos < data.size();) {
+        auto index = _end % capacity;
+        auto count = std::min(data.size() - pos, capacity - index);
+
+        std::copy_n(data.data() + pos, count, _buffer.data() + index);
+        pos += count;
+        _end += count;
+      }
+    }
+
+    _cv.notify_all();
+  }
+
+  bool log_tail_t::read(std::uint64_t offset, std::size_t max_size, std::string &out) const {
+    std::lock_guard lg {_lock};
+
+    auto capacity = _buffer.size();
+    auto begin = _end > capacity ? _end - capacity : 0;
+    if (offset < begin) {
+      return false;
+    }
+
+    auto size = (std::size_t) std::min<std::uint64_t>(max_size, _end > offset ? _end - offset : 0);
+    out.resize(size);
+
+    for (std::size_t pos = 0; pos < size;) {
+      auto index = (offset + pos) % capacity;
+      auto count = std::min(size - pos, capacity - index);
+
+      std::copy_n(_buffer.data() + index, count, out.data() + pos);
+      pos += count;
+    }
+
+    return true;
+  }
+
+  bool log_tail_t::wait_for(std::uint64_t offset, std::chrono::milliseconds timeout) const {
+    std::unique_lock ul {_lock};
+
+    return _cv.wait_for(ul, timeout, [&]() {
+      return _end > offset;
+    });
+  }
+
+  std::uint64_t log_tail_t::end_offset() const {
+    std::lock_guard lg {_lock};
+
+    return _end;
+  }
+
+  std::shared_ptr<log_tail_t> get_log_tail() {
+    return log_tail;
+  }
+
+  log_chunk_t read_log(std::uint64_t offset, std::size_t max_size) {
+    auto tail = get_log_tail();
+    if (!tail) {
+      return {};
+    }
+
+    log_chunk_t chunk;
+    chunk.id = tail->id;
+    chunk.size = tail->end_offset();
+    chunk.begin = std::min(offset, chunk.size);
+
+    if (!tail->read(chunk.begin, max_size, chunk.data)) {
+      // Older than what is kept in memory, read that range from the log file instead
+      std::ifstream in(log_path, std::ios::binary);
+      in.seekg((std::streamoff) chunk.begin);
+
+      chunk.data.resize((std::size_t) std::min<std::uint64_t>(max_size, chunk.size - chunk.begin));
+      in.read(chunk.data.data(), (std::streamsize) chunk.data.size());
+      chunk.data.resize((std::size_t) in.gcount());
+    }
+
+    chunk.end = chunk.begin + chunk.data.size();
+    chunk.size = std::max(chunk.size, chunk.end);
+
+    return chunk;
+  }
+
   deinit_t::~deinit_t() {
     deinit();
   }
 
   void deinit() {
+    if (flush_thread.joinable()) {
+      {
+        std::lock_guard lg {flush_lock};
+        flush_stop = true;
+      }
+      flush_cv.notify_all();
+      flush_thread.join();
+    }
+
     log_flush();
     bl::core::get()->remove_sink(sink);
     sink.reset();
@@ -99,7 +337,7 @@ namespace logging {
        << log_type << view.attribute_values()[message].extract<std::string>();
   }
 
-  [[nodiscard]] std::unique_ptr<deinit_t> init(int min_log_level, const std::string &log_file) {
+  [[nodiscard]] std::unique_ptr<deinit_t> init(int min_log_level, const std::string &log_file, std::chrono::milliseconds flush_interval) {
     if (sink) {
       // Deinitialize the logging system before reinitializing it. This can probably only ever be hit in tests.
       deinit();
@@ -119,19 +357,37 @@ namespace logging {
     setup_av_logging(min_log_level);
     setup_libdisplaydevice_logging(min_log_level);
 
-    sink = boost::make_shared<text_sink>();
+    // Flushing after each log record ensures the log file contents on disk aren't stale, which is
+    // particularly important when running from a Windows service. Batching trades a bounded delay
+    // for far fewer writes when debug logging is enabled, warnings and errors are never held back.
+    sink = boost::make_shared<text_sink>(boost::make_shared<batch_backend_t>(flush_interval));
 
 #ifndef SUNSHINE_TESTS
     boost::shared_ptr<std::ostream> stream {&std::cout, boost::null_deleter()};
     sink->locked_backend()->add_stream(stream);
   #endif
     sink->locked_backend()->add_stream(boost::make_shared<std::ofstream>(log_file));
+
+    log_path = log_file;
+    log_tail = std::make_shared<log_tail_t>(LOG_TAIL_CAPACITY);
+    sink->locked_backend()->add_stream(boost::make_shared<log_tail_stream_t>(log_tail));
     sink->set_filter(severity >= min_log_level);
+    min_level = min_log_level;
     sink->set_formatter(&formatter);
 
-    // Flush after each log record to ensure log file contents on disk isn't stale.
-    // This is particularly important when running from a Windows service.
-    sink->locked_backend()->auto_flush(true);
+    if (flush_interval > 0ms) {
+      flush_stop = false;
+      flush_thread = std::thread {[flush_interval]() {
+        std::unique_lock ul {flush_lock};
+        while (!flush_cv.wait_for(ul, flush_interval, []() {
+          return flush_stop;
+        })) {
+          ul.unlock();
+          sink->flush();
+          ul.lock();
+        }
+      }};
+    }
 
     bl::core::get()->add_sink(sink);
     return std::make_unique<deinit_t>();
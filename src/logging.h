@@ -4,12 +4,21 @@
  */
 #pragma once
 
+// standard includes
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
 // lib includes
 #include <boost/log/common.hpp>
 #include <boost/log/sinks.hpp>
 
-using text_sink = boost::log::sinks::asynchronous_sink<boost::log::sinks::text_ostream_backend>;
-
 extern boost::log::sources::severity_logger<int> verbose;
 extern boost::log::sources::severity_logger<int> debug;
 extern boost::log::sources::severity_logger<int> info;
@@ -23,10 +32,80 @@ extern boost::log::sources::severity_logger<int> tests;
 #include "config.h"
 #include "stat_trackers.h"
 
+/**
+ * @brief Log statements of a lower level than this are compiled out when written with SUNSHINE_LOG.
+ * @details Release builds can define it, e.g. to 1, to strip verbose logging from the streaming hot paths.
+ */
+#ifndef SUNSHINE_LOG_MIN_LEVEL
+  #define SUNSHINE_LOG_MIN_LEVEL 0
+#endif
+
+/**
+ * @brief Same as BOOST_LOG, but checks the log level before touching Boost.Log at all.
+ * @details Use it on hot paths, where even filtered out log statements are too expensive.
+ *          The arguments are not evaluated if the log level is disabled.
+ * @examples
+ * SUNSHINE_LOG(verbose) << "Audio ["sv << sequenceNumber << "] ::  send..."sv;
+ * @examples_end
+ */
+#define SUNSHINE_LOG(logger) \
+  if (!logging::enabled(logger)) { \
+  } else \
+    BOOST_LOG(logger)
+
 /**
  * @brief Handles the initialization and deinitialization of the logging system.
  */
 namespace logging {
+  /**
+   * @brief The minimum log level of the sink, cached for SUNSHINE_LOG.
+   */
+  extern std::atomic<int> min_level;
+
+  /**
+   * @brief Get the log level of one of the global loggers.
+   * @param logger The logger.
+   * @return The log level, or the highest possible level for any other logger, which leaves filtering to Boost.Log.
+   */
+  inline int severity_of(const boost::log::sources::severity_logger<int> &logger) {
+    // The global loggers are known at compile time, so this folds into a constant
+    if (&logger == &verbose) {
+      return 0;
+    }
+    if (&logger == &debug) {
+      return 1;
+    }
+    if (&logger == &info) {
+      return 2;
+    }
+    if (&logger == &warning) {
+      return 3;
+    }
+    if (&logger == &error) {
+      return 4;
+    }
+    if (&logger == &fatal) {
+      return 5;
+    }
+
+    return std::numeric_limits<int>::max();
+  }
+
+  /**
+   * @brief Check whether a log statement would be written.
+   * @param logger The logger.
+   * @return `false` if the log level of the logger is filtered out.
+   * @examples
+   * if (logging::enabled(debug)) {
+   *   input::print(payload);
+   * }
+   * @examples_end
+   */
+  inline bool enabled(const boost::log::sources::severity_logger<int> &logger) {
+    auto level = severity_of(logger);
+    return level >= SUNSHINE_LOG_MIN_LEVEL && level >= min_level.load(std::memory_order_relaxed);
+  }
+
   class deinit_t {
   public:
     /**
@@ -49,12 +128,13 @@ namespace logging {
    * @brief Initialize the logging system.
    * @param min_log_level The minimum log level to output.
    * @param log_file The log file to write to.
+   * @param flush_interval How long log records may be held back before they are written out, 0 writes every record immediately.
    * @return An object that will deinitialize the logging system when it goes out of scope.
    * @examples
-   * log_init(2, "sunshine.log");
+   * log_init(2, "sunshine.log", 250ms);
    * @examples_end
    */
-  [[nodiscard]] std::unique_ptr<deinit_t> init(int min_log_level, const std::string &log_file);
+  [[nodiscard]] std::unique_ptr<deinit_t> init(int min_log_level, const std::string &log_file, std::chrono::milliseconds flush_interval = std::chrono::milliseconds::zero());
 
   /**
    * @brief Setup AV logging.
@@ -76,6 +156,89 @@ namespace logging {
    */
   void log_flush();
 
+  /**
+   * @brief In-memory copy of the most recent output of the log file.
+   * @details It is fed by the log sink with exactly the bytes written to the log file,
+   *          so positions in the buffer are byte offsets in the log file as well.
+   */
+  class log_tail_t {
+  public:
+    /**
+     * @param capacity The number of most recent bytes to keep in memory.
+     */
+    explicit log_tail_t(std::size_t capacity);
+
+    /**
+     * @brief Append complete records to the buffer and wake up waiting readers.
+     * @param data The formatted records.
+     */
+    void append(const std::string_view &data);
+
+    /**
+     * @brief Copy buffered output starting at an offset.
+     * @param offset The offset in the log file.
+     * @param max_size The maximum number of bytes to copy.
+     * @param out Receives the data.
+     * @return `false` if the offset is no longer buffered and has to be read from the log file.
+     */
+    bool read(std::uint64_t offset, std::size_t max_size, std::string &out) const;
+
+    /**
+     * @brief Wait until output past an offset is available.
+     * @param offset The offset in the log file.
+     * @param timeout The maximum time to wait.
+     * @return `true` if new output is available.
+     */
+    bool wait_for(std::uint64_t offset, std::chrono::milliseconds timeout) const;
+
+    /**
+     * @brief Get the offset of the end of the log file.
+     */
+    std::uint64_t end_offset() const;
+
+    /**
+     * @brief Identifies the log file, which is replaced each time logging is initialized.
+     */
+    const std::string id;
+
+  private:
+    mutable std::mutex _lock;
+    mutable std::condition_variable _cv;
+
+    std::string _buffer;
+    std::uint64_t _end;
+  };
+
+  /**
+   * @brief A range of the log file.
+   */
+  struct log_chunk_t {
+    std::string id;  ///< The id of the log file the data belongs to
+    std::uint64_t begin;  ///< Offset of the first byte of data
+    std::uint64_t end;  ///< Offset past the last byte of data
+    std::uint64_t size;  ///< Current size of the log file
+    std::string data;
+  };
+
+  /**
+   * @brief Get the in-memory copy of the log output.
+   * @return The log tail, or `nullptr` if logging isn't initialized.
+   */
+  std::shared_ptr<log_tail_t> get_log_tail();
+
+  /**
+   * @brief Read the log output starting at an offset.
+   * @details Recent output is served from memory, older output is read from the log file.
+   * @param offset The offset in the log file.
+   * @param max_size The maximum number of bytes to read.
+   * @return The requested range, possibly shorter than `max_size` if the end of the log was reached.
+   * @examples
+   * auto chunk = logging::read_log(0, 1024 * 1024);
+   * auto next = logging::read_log(chunk.end, 1024 * 1024);
+   * @examples_end
+   */
+  log_chunk_t read_log(std::uint64_t offset, std::size_t max_size);
+
   /**
    * @brief Print help to stdout.
    * @param name The name of the program.
@@ -112,7 +112,7 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
-  auto log_deinit_guard = logging::init(config::sunshine.min_log_level, config::sunshine.log_file);
+  auto log_deinit_guard = logging::init(config::sunshine.min_log_level, config::sunshine.log_file, config::sunshine.log_flush_interval);
   if (!log_deinit_guard) {
     BOOST_LOG(error) << "Logging failed to initialize"sv;
   }
@@ -344,6 +344,8 @@ int main(int argc, char *argv[]) {
 
   rtsp_stream::rtpThread();
 
+  video::retire_warm_session();
+
   httpThread.join();
   configThread.join();
 
@@ -6,10 +6,15 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <tuple>
+#include <unordered_map>
 #include <utility>
-#include <string>
 
 // lib includes
 #include <boost/asio/ssl/context.hpp>
@@ -20,6 +25,7 @@
 #include <Simple-Web-Server/server_http.hpp>
 
 // local includes
+#include "asset_cache.h"
 #include "config.h"
 #include "display_device.h"
 #include "file_handler.h"
@@ -51,10 +57,6 @@ namespace nvhttp {
   using p_named_cert_t = crypto::p_named_cert_t;
   using PERM = crypto::PERM;
 
-  struct client_t {
-    std::vector<p_named_cert_t> named_devices;
-  };
-
   struct pair_session_t;
 
   crypto::cert_chain_t cert_chain;
@@ -149,6 +151,82 @@ namespace nvhttp {
   client_t client_root;
   std::atomic<uint32_t> session_id_counter;
 
+  // Incremented whenever a client is paired, unpaired or has its permissions changed
+  std::atomic<uint32_t> pairing_generation;
+
+  /**
+   * @brief Pre-rendered serverinfo/applist responses.
+   * @details Clients poll these endpoints every few seconds, yet the XML only depends on the
+   *          app list, the encoder probe results, the pairing state and a few per-request inputs
+   *          that callers fold into the key. Once any generation moves on, the whole cache is dropped.
+   */
+  class response_cache_t {
+  public:
+    using generation_t = std::tuple<uint32_t, uint32_t, uint32_t>;
+
+    static generation_t current_generation() {
+      return {proc::app_list_generation.load(), video::encoder_probe_generation.load(), pairing_generation.load()};
+    }
+
+    /**
+     * @brief Look up a rendered response.
+     * @param key The per-request inputs the response depends on.
+     * @param generation Receives the generation the caller must render against on a miss.
+     */
+    std::optional<std::string> get(const std::string &key, generation_t &generation) {
+      std::lock_guard lg {_lock};
+
+      generation = sync();
+      auto it = _responses.find(key);
+      if (it == std::end(_responses)) {
+        return std::nullopt;
+      }
+
+      return it->second;
+    }
+
+    /**
+     * @brief Store a rendered response, unless its inputs changed while it was being rendered.
+     */
+    void put(const std::string &key, const std::string &data, const generation_t &generation) {
+      std::lock_guard lg {_lock};
+
+      if (sync() != generation) {
+        return;
+      }
+
+      // The key space is small in practice, this only guards against unbounded growth
+      if (_responses.size() >= MAX_ENTRIES) {
+        _responses.clear();
+      }
+
+      _responses.insert_or_assign(key, data);
+    }
+
+  private:
+    static constexpr std::size_t MAX_ENTRIES = 64;
+
+    generation_t sync() {
+      auto generation = current_generation();
+      if (generation != _generation) {
+        _responses.clear();
+        _generation = generation;
+      }
+
+      return generation;
+    }
+
+    std::mutex _lock;
+    generation_t _generation;
+    std::unordered_map<std::string, std::string> _responses;
+  };
+
+  response_cache_t serverinfo_cache;
+  response_cache_t applist_cache;
+
+  // Cover art requested by the app grid of the clients
+  asset_cache::file_cache_t app_assets {32 * 1024 * 1024};
+
   using resp_https_t = std::shared_ptr<typename SimpleWeb::ServerBase<SunshineHTTPS>::Response>;
   using req_https_t = std::shared_ptr<typename SimpleWeb::ServerBase<SunshineHTTPS>::Request>;
   using resp_http_t = std::shared_ptr<typename SimpleWeb::ServerBase<SimpleWeb::HTTP>::Response>;
@@ -201,89 +279,231 @@ namespace nvhttp {
     return commands;
   }
 
-  void save_state() {
-    nlohmann::json root = nlohmann::json::object();
-    // If the state file exists, try to read it.
-    if (fs::exists(config::nvhttp.file_state)) {
-      try {
-        std::ifstream in(config::nvhttp.file_state);
-        in >> root;
-      } catch (std::exception &e) {
-        BOOST_LOG(error) << "Couldn't read "sv << config::nvhttp.file_state << ": "sv << e.what();
-        return;
+  // Changes to the paired clients are appended here, the state file is only rewritten once enough of them piled up
+  std::mutex state_journal_lock;
+  std::size_t state_journal_entries = 0;
+  constexpr std::size_t state_journal_limit = 64;
+
+  // Snapshots of the clients are numbered, so a compaction still queued never overwrites a newer state file
+  std::uint64_t state_snapshots = 0;
+  std::uint64_t state_file_snapshot = 0;
+
+  fs::path state_journal_file() {
+    return config::nvhttp.file_state + ".journal";
+  }
+
+  /**
+   * @brief The journal being folded into the state file by a pending compaction.
+   */
+  fs::path state_journal_old_file() {
+    return config::nvhttp.file_state + ".journal.old";
+  }
+
+  nlohmann::json serialize_named_cert(const crypto::named_cert_t &named_cert, const std::string &name) {
+    nlohmann::json named_cert_node = nlohmann::json::object();
+    named_cert_node["name"] = name;
+    named_cert_node["cert"] = named_cert.cert;
+    named_cert_node["uuid"] = named_cert.uuid;
+    named_cert_node["perm"] = static_cast<uint32_t>(named_cert.perm);
+
+    // Add "do" commands if available.
+    if (!named_cert.do_cmds.empty()) {
+      nlohmann::json do_cmds_node = nlohmann::json::array();
+      for (const auto &cmd : named_cert.do_cmds) {
+        do_cmds_node.push_back(crypto::command_entry_t::serialize(cmd));
       }
+      named_cert_node["do"] = do_cmds_node;
     }
 
-    // Erase any previous "root" key.
-    root.erase("root");
+    // Add "undo" commands if available.
+    if (!named_cert.undo_cmds.empty()) {
+      nlohmann::json undo_cmds_node = nlohmann::json::array();
+      for (const auto &cmd : named_cert.undo_cmds) {
+        undo_cmds_node.push_back(crypto::command_entry_t::serialize(cmd));
+      }
+      named_cert_node["undo"] = undo_cmds_node;
+    }
 
-    // Create a new "root" object and set the unique id.
-    root["root"] = nlohmann::json::object();
-    root["root"]["uniqueid"] = http::unique_id;
+    return named_cert_node;
+  }
 
-    client_t &client = client_root;
+  p_named_cert_t deserialize_named_cert(const nlohmann::json &el) {
+    auto named_cert_p = std::make_shared<crypto::named_cert_t>();
+    named_cert_p->name = el.value("name", "");
+    named_cert_p->cert = el.value("cert", "");
+    named_cert_p->uuid = el.value("uuid", "");
+    named_cert_p->perm = (PERM)(util::get_non_string_json_value<uint32_t>(el, "perm", (uint32_t)PERM::_all)) & PERM::_all;
+    // Load command entries for "do" and "undo" keys.
+    named_cert_p->do_cmds = extract_command_entries(el, "do");
+    named_cert_p->undo_cmds = extract_command_entries(el, "undo");
+
+    return named_cert_p;
+  }
+
+  /**
+   * @brief Remove any pending id suffix (e.g., " (2)") from a device name.
+   */
+  std::string device_base_name(const std::string &name) {
+    return name.substr(0, name.find(" ("));
+  }
+
+  nlohmann::json serialize_named_devices(const client_t &client) {
     nlohmann::json named_cert_nodes = nlohmann::json::array();
 
     std::unordered_set<std::string> unique_certs;
-    std::unordered_map<std::string, int> name_counts;
 
+    // Names are written as they are, so the state file agrees with the journal
     for (auto &named_cert_p : client.named_devices) {
       // Only add each unique certificate once.
       if (unique_certs.insert(named_cert_p->cert).second) {
-        nlohmann::json named_cert_node = nlohmann::json::object();
-        std::string base_name = named_cert_p->name;
-        // Remove any pending id suffix (e.g., " (2)") if present.
-        size_t pos = base_name.find(" (");
-        if (pos != std::string::npos) {
-          base_name = base_name.substr(0, pos);
-        }
-        int count = name_counts[base_name]++;
-        std::string final_name = base_name;
-        if (count > 0) {
-          final_name += " (" + std::to_string(count + 1) + ")";
-        }
-        named_cert_node["name"] = final_name;
-        named_cert_node["cert"] = named_cert_p->cert;
-        named_cert_node["uuid"] = named_cert_p->uuid;
-        named_cert_node["perm"] = static_cast<uint32_t>(named_cert_p->perm);
-
-        // Add "do" commands if available.
-        if (!named_cert_p->do_cmds.empty()) {
-          nlohmann::json do_cmds_node = nlohmann::json::array();
-          for (const auto &cmd : named_cert_p->do_cmds) {
-            do_cmds_node.push_back(crypto::command_entry_t::serialize(cmd));
-          }
-          named_cert_node["do"] = do_cmds_node;
-        }
+        named_cert_nodes.push_back(serialize_named_cert(*named_cert_p, named_cert_p->name));
+      }
+    }
 
-        // Add "undo" commands if available.
-        if (!named_cert_p->undo_cmds.empty()) {
-          nlohmann::json undo_cmds_node = nlohmann::json::array();
-          for (const auto &cmd : named_cert_p->undo_cmds) {
-            undo_cmds_node.push_back(crypto::command_entry_t::serialize(cmd));
-          }
-          named_cert_node["undo"] = undo_cmds_node;
-        }
+    return named_cert_nodes;
+  }
 
-        named_cert_nodes.push_back(named_cert_node);
-      }
+  bool write_state(nlohmann::json named_devices, std::uint64_t snapshot) {
+    std::lock_guard lg {http::state_file_lock};
+
+    if (snapshot < state_file_snapshot) {
+      return false;
     }
 
-    root["root"]["named_devices"] = named_cert_nodes;
+    auto written = http::update_json_file(config::nvhttp.file_state, [&](nlohmann::json &root) {
+      // Erase any previous "root" key.
+      root.erase("root");
 
-    try {
-      std::ofstream out(config::nvhttp.file_state);
-      out << root.dump(4);  // Pretty-print with an indent of 4 spaces.
-    } catch (std::exception &e) {
-      BOOST_LOG(error) << "Couldn't write "sv << config::nvhttp.file_state << ": "sv << e.what();
+      // Create a new "root" object and set the unique id.
+      root["root"] = nlohmann::json::object();
+      root["root"]["uniqueid"] = http::unique_id;
+      root["root"]["named_devices"] = std::move(named_devices);
+
+      return true;
+    });
+    if (!written) {
+      return false;
+    }
+    state_file_snapshot = snapshot;
+
+    return true;
+  }
+
+  /**
+   * @brief Rewrite the state file from the clients in memory and drop the journal.
+   */
+  void save_state() {
+    std::lock_guard lg {state_journal_lock};
+
+    if (!write_state(serialize_named_devices(client_root), ++state_snapshots)) {
+      return;
+    }
+
+    std::error_code ec;
+    fs::remove(state_journal_old_file(), ec);
+    fs::remove(state_journal_file(), ec);
+    state_journal_entries = 0;
+  }
+
+  /**
+   * @brief Fold the journal into the state file on the task pool.
+   * @note Must be called with `state_journal_lock` held.
+   */
+  void compact_state() {
+    std::error_code ec;
+
+    // The previous compaction hasn't finished yet, try again with the next change
+    if (fs::exists(state_journal_old_file(), ec)) {
       return;
     }
+
+    // Later changes go to a fresh journal, the old one is only removed once the state file contains it
+    fs::rename(state_journal_file(), state_journal_old_file(), ec);
+    if (ec) {
+      BOOST_LOG(warning) << "Couldn't rotate "sv << state_journal_file() << ": "sv << ec.message();
+      return;
+    }
+    state_journal_entries = 0;
+
+    task_pool.push([named_devices = serialize_named_devices(client_root), snapshot = ++state_snapshots]() mutable {
+      if (write_state(std::move(named_devices), snapshot)) {
+        std::error_code ec;
+        fs::remove(state_journal_old_file(), ec);
+      }
+    });
+  }
+
+  /**
+   * @brief Record a change to the paired clients.
+   * @param entry The change, either `{"put": device}` or `{"remove": uuid}`.
+   */
+  void journal_state(const nlohmann::json &entry) {
+    std::lock_guard lg {state_journal_lock};
+
+    {
+      std::ofstream out(state_journal_file(), std::ios::app);
+      out << entry.dump() << '\n';
+      if (!out.flush()) {
+        BOOST_LOG(error) << "Couldn't write "sv << state_journal_file();
+        return;
+      }
+    }
+
+    if (++state_journal_entries >= state_journal_limit) {
+      compact_state();
+    }
+  }
+
+  std::size_t replay_state_journal(const fs::path &file, client_t &client) {
+    std::ifstream in(file);
+
+    std::size_t applied = 0;
+    for (std::string line; std::getline(in, line);) {
+      nlohmann::json entry;
+      try {
+        entry = nlohmann::json::parse(line);
+      } catch (std::exception &e) {
+        // A crash can only tear the last change, load_state() folds the journal before anything is appended again
+        BOOST_LOG(warning) << "Ignoring the end of "sv << file << ": "sv << e.what();
+        break;
+      }
+
+      std::string uuid = entry.contains("put") ? entry["put"].value("uuid", "") : entry.value("remove", "");
+      auto it = std::find_if(std::begin(client.named_devices), std::end(client.named_devices), [&uuid](const auto &named_cert_p) {
+        return named_cert_p->uuid == uuid;
+      });
+
+      if (entry.contains("put")) {
+        auto named_cert_p = deserialize_named_cert(entry["put"]);
+        if (it != std::end(client.named_devices)) {
+          *it = std::move(named_cert_p);
+        } else {
+          client.named_devices.emplace_back(std::move(named_cert_p));
+        }
+      } else if (it != std::end(client.named_devices)) {
+        client.named_devices.erase(it);
+      }
+
+      ++applied;
+    }
+
+    return applied;
+  }
+
+  void rebuild_cert_chain() {
+    cert_chain.clear();
+    for (auto &named_cert : client_root.named_devices) {
+      cert_chain.add(named_cert);
+    }
   }
 
   void load_state() {
     if (!fs::exists(config::nvhttp.file_state)) {
       BOOST_LOG(info) << "File "sv << config::nvhttp.file_state << " doesn't exist"sv;
       http::unique_id = uuid_util::uuid_t::generate().string();
+
+      // The journal relies on the state file for the unique id
+      save_state();
       return;
     }
 
@@ -300,6 +520,7 @@ namespace nvhttp {
     if (!tree.contains("root") || !tree["root"].contains("uniqueid")) {
       http::uuid = uuid_util::uuid_t::generate();
       http::unique_id = http::uuid.string();
+      save_state();
       return;
     }
 
@@ -330,38 +551,61 @@ namespace nvhttp {
     // Import from the new format.
     if (root.contains("named_devices")) {
       for (auto &el : root["named_devices"]) {
-        auto named_cert_p = std::make_shared<crypto::named_cert_t>();
-        named_cert_p->name = el.value("name", "");
-        named_cert_p->cert = el.value("cert", "");
-        named_cert_p->uuid = el.value("uuid", "");
-        named_cert_p->perm = (PERM)(util::get_non_string_json_value<uint32_t>(el, "perm", (uint32_t)PERM::_all)) & PERM::_all;
-        // Load command entries for "do" and "undo" keys.
-        named_cert_p->do_cmds = extract_command_entries(el, "do");
-        named_cert_p->undo_cmds = extract_command_entries(el, "undo");
-        client.named_devices.emplace_back(named_cert_p);
+        client.named_devices.emplace_back(deserialize_named_cert(el));
       }
     }
 
-    // Clear any existing certificate chain and add the imported certificates.
-    cert_chain.clear();
-    for (auto &named_cert : client.named_devices) {
-      cert_chain.add(named_cert);
-    }
+    // Changes that weren't folded into the state file yet, the old journal predates the current one
+    std::error_code ec;
+    auto journaled = fs::exists(state_journal_old_file(), ec) || fs::exists(state_journal_file(), ec);
+    auto replayed = replay_state_journal(state_journal_old_file(), client);
+    replayed += replay_state_journal(state_journal_file(), client);
 
     client_root = client;
+
+    // Clear any existing certificate chain and add the imported certificates.
+    rebuild_cert_chain();
+
+    // Fold the journals even if nothing could be replayed, new changes must never be appended to a torn line
+    if (journaled) {
+      BOOST_LOG(debug) << "Replayed "sv << replayed << " changes to paired clients"sv;
+      save_state();
+    }
   }
 
   void add_authorized_client(const p_named_cert_t& named_cert_p) {
     client_t &client = client_root;
+
+    // Each certificate is only stored once, the client that paired first keeps it
+    for (auto &existing : client.named_devices) {
+      if (existing->cert == named_cert_p->cert) {
+        BOOST_LOG(debug) << "Client ["sv << named_cert_p->name << "] is already paired as ["sv << existing->name << ']';
+        return;
+      }
+    }
+
+    // Clients sharing a name get the lowest free suffix, so unpairing one never leads to duplicates
+    std::unordered_set<std::string> names;
+    for (auto &existing : client.named_devices) {
+      names.insert(existing->name);
+    }
+
+    auto base_name = device_base_name(named_cert_p->name);
+    named_cert_p->name = base_name;
+    for (int x = 2; names.contains(named_cert_p->name); ++x) {
+      named_cert_p->name = base_name + " (" + std::to_string(x) + ")";
+    }
+
     client.named_devices.push_back(named_cert_p);
+    cert_chain.add(named_cert_p);
+    ++pairing_generation;
 
 #if defined SUNSHINE_TRAY && SUNSHINE_TRAY >= 1
     system_tray::update_tray_paired(named_cert_p->name);
 #endif
 
     if (!config::sunshine.flags[config::flag::FRESH_STATE]) {
-      save_state();
-      load_state();
+      journal_state({{"put", serialize_named_cert(*named_cert_p, named_cert_p->name)}});
     }
   }
 
@@ -856,6 +1100,36 @@ namespace nvhttp {
     }
 
     auto local_endpoint = request->local_endpoint();
+    auto local_address = net::addr_to_normalized_string(local_endpoint.address());
+
+    crypto::named_cert_t *named_cert_p = nullptr;
+    int current_appid = 0;
+    if constexpr (std::is_same_v<SunshineHTTPS, T>) {
+      named_cert_p = get_verified_cert(request);
+
+      current_appid = proc::proc.running();
+      // When input only mode is enabled, the only resume method should be launching the same app again.
+      if (config::input.enable_input_only_mode && current_appid != proc::input_only_app_id) {
+        current_appid = 0;
+      }
+    }
+
+    // Everything the response depends on, besides the inputs tracked by the cache generation
+    std::ostringstream cache_key;
+    cache_key << tunnel<T>::to_string << '|' << local_address << '|' << pair_status << '|' << current_appid;
+    if constexpr (std::is_same_v<SunshineHTTPS, T>) {
+      cache_key << '|' << (uint32_t) named_cert_p->perm;
+#ifdef _WIN32
+      cache_key << '|' << (int) proc::vDisplayDriverStatus;
+#endif
+    }
+
+    response_cache_t::generation_t generation;
+    if (auto cached = serverinfo_cache.get(cache_key.str(), generation)) {
+      response->write(*cached);
+      response->close_connection_after_response = true;
+      return;
+    }
 
     pt::ptree tree;
 
@@ -872,9 +1146,8 @@ namespace nvhttp {
     // Only include the MAC address for requests sent from paired clients over HTTPS.
     // For HTTP requests, use a placeholder MAC address that Moonlight knows to ignore.
     if constexpr (std::is_same_v<SunshineHTTPS, T>) {
-      tree.put("root.mac", platf::get_mac_address(net::addr_to_normalized_string(local_endpoint.address())));
+      tree.put("root.mac", platf::get_mac_address(local_address));
 
-      auto named_cert_p = get_verified_cert(request);
       if (!!(named_cert_p->perm & PERM::server_cmd)) {
         pt::ptree& root_node = tree.get_child("root");
 
@@ -917,7 +1190,7 @@ namespace nvhttp {
     if (local_endpoint.address().is_v6() && !local_endpoint.address().to_v6().is_v4_mapped()) {
       tree.put("root.LocalIP", "127.0.0.1");
     } else {
-      tree.put("root.LocalIP", net::addr_to_normalized_string(local_endpoint.address()));
+      tree.put("root.LocalIP", local_address);
     }
 
     uint32_t codec_mode_flags = SCM_H264;
@@ -953,11 +1226,6 @@ namespace nvhttp {
     tree.put("root.PairStatus", pair_status);
 
     if constexpr (std::is_same_v<SunshineHTTPS, T>) {
-      int current_appid = proc::proc.running();
-      // When input only mode is enabled, the only resume method should be launching the same app again.
-      if (config::input.enable_input_only_mode && current_appid != proc::input_only_app_id) {
-        current_appid = 0;
-      }
       tree.put("root.currentgame", current_appid);
       tree.put("root.state", current_appid > 0 ? "SUNSHINE_SERVER_BUSY" : "SUNSHINE_SERVER_FREE");
     } else {
@@ -968,6 +1236,8 @@ namespace nvhttp {
     std::ostringstream data;
 
     pt::write_xml(data, tree);
+    serverinfo_cache.put(cache_key.str(), data.str(), generation);
+
     response->write(data.str());
     response->close_connection_after_response = true;
   }
@@ -1025,23 +1295,43 @@ namespace nvhttp {
   void applist(resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
+    auto named_cert_p = get_verified_cert(request);
+    bool can_list = !!(named_cert_p->perm & PERM::_all_actions);
+    if (!can_list) {
+      BOOST_LOG(debug) << "Permission ListApp denied for [" << named_cert_p->name << "] (" << (uint32_t)named_cert_p->perm << ")";
+    }
+
+    // The running app only affects the list when input only mode hides inactive apps
+    auto current_appid = can_list && config::input.enable_input_only_mode ? proc::proc.running() : 0;
+    auto cache_key = std::to_string(can_list) + '|' + std::to_string(current_appid);
+
+    response_cache_t::generation_t generation;
+    auto cached = applist_cache.get(cache_key, generation);
+
     pt::ptree tree;
 
     auto g = util::fail_guard([&]() {
-      std::ostringstream data;
+      if (!cached) {
+        std::ostringstream data;
 
-      pt::write_xml(data, tree);
-      response->write(data.str());
+        pt::write_xml(data, tree);
+        cached = data.str();
+        applist_cache.put(cache_key, *cached, generation);
+      }
+
+      response->write(*cached);
       response->close_connection_after_response = true;
     });
 
+    if (cached) {
+      return;
+    }
+
     auto &apps = tree.add_child("root", pt::ptree {});
 
     apps.put("<xmlattr>.status_code", 200);
 
-    auto named_cert_p = get_verified_cert(request);
-    if (!!(named_cert_p->perm & PERM::_all_actions)) {
-      auto current_appid = proc::proc.running();
+    if (can_list) {
       auto should_hide_inactive_apps = config::input.enable_input_only_mode && current_appid > 0 && current_appid != proc::input_only_app_id;
       for (auto &app : proc::proc.get_apps()) {
         auto appid = util::from_view(app.id);
@@ -1073,8 +1363,6 @@ namespace nvhttp {
         apps.push_back(std::make_pair("App", std::move(app_node)));
       }
     } else {
-      BOOST_LOG(debug) << "Permission ListApp denied for [" << named_cert_p->name << "] (" << (uint32_t)named_cert_p->perm << ")";
-
       pt::ptree app_node;
 
       app_node.put("IsHdrSupported"s, 0);
@@ -1417,12 +1705,14 @@ namespace nvhttp {
     auto args = request->parse_query_string();
     auto app_image = proc::proc.get_app_image(util::from_view(get_arg(args, "appid")));
 
+    auto asset = app_assets.load(app_image, "image/png");
+    if (!asset) {
+      return;
+    }
+
     fg.disable();
 
-    std::ifstream in(app_image, std::ios::binary);
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "image/png");
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    asset_cache::write(response, request, *asset);
     response->close_connection_after_response = true;
   }
 
@@ -1691,8 +1981,8 @@ namespace nvhttp {
     client_t client;
     client_root = client;
     cert_chain.clear();
+    ++pairing_generation;
     save_state();
-    load_state();
   }
 
   void stop_session(stream::session_t& session, bool graceful) {
@@ -1743,7 +2033,8 @@ namespace nvhttp {
         named_cert_p->perm = newPerm;
         named_cert_p->do_cmds = do_cmds;
         named_cert_p->undo_cmds = undo_cmds;
-        save_state();
+        ++pairing_generation;
+        journal_state({{"put", serialize_named_cert(*named_cert_p, name)}});
         return true;
       }
     }
@@ -1758,15 +2049,16 @@ namespace nvhttp {
       if ((*it)->uuid == uuid) {
         it = client.named_devices.erase(it);
         removed = true;
+        ++pairing_generation;
       } else {
         ++it;
       }
     }
 
-    save_state();
-    load_state();
-
     if (removed) {
+      rebuild_cert_chain();
+      journal_state({{"remove", std::string {uuid}}});
+
       auto session = rtsp_stream::find_session(uuid);
       if (session) {
         stop_session(*session, true);
@@ -8,7 +8,11 @@
 // standard includes
 #include <string>
 #include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
 #include <list>
+#include <vector>
 
 // lib includes
 #include <boost/property_tree/ptree.hpp>
@@ -92,6 +96,13 @@ namespace nvhttp {
     }
   };
 
+  /**
+   * @brief The paired clients.
+   */
+  struct client_t {
+    std::vector<crypto::p_named_cert_t> named_devices;
+  };
+
   enum class PAIR_PHASE {
     NONE,  ///< Sunshine is not in a pairing phase
     GETSERVERCERT,  ///< Sunshine is in the get server certificate phase
@@ -275,4 +286,26 @@ namespace nvhttp {
     const cmd_list_t& undo_cmds,
     const crypto::PERM newPerm
   );
+
+  /**
+   * @brief Replace the paired clients in the state file, keeping everything else it holds.
+   * @param named_devices The serialized clients.
+   * @param snapshot The number of the snapshot the clients were serialized in.
+   * @return `true` on success, `false` on failure or if a newer snapshot was written already.
+   */
+  bool write_state(nlohmann::json named_devices, std::uint64_t snapshot);
+
+  /**
+   * @brief Apply the changes recorded in a journal.
+   * @details Replay stops at the first change that can't be parsed, which only a crash can leave behind as the last line.
+   * @param file The journal.
+   * @param client The clients to apply the changes to.
+   * @return The number of changes applied.
+   */
+  std::size_t replay_state_journal(const std::filesystem::path &file, client_t &client);
+
+  /**
+   * @brief Load the paired clients from the state file and the journals not yet folded into it.
+   */
+  void load_state();
 }  // namespace nvhttp
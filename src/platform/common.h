@@ -584,6 +584,12 @@ namespace platf {
    */
   bool needs_encoder_reenumeration();
 
+  /**
+   * @brief Describe the GPUs and drivers that encoder validation depends on.
+   * @return A description that changes whenever GPUs or drivers change, or an empty string if it can't be determined.
+   */
+  std::string gpu_environment_id();
+
   boost::process::v1::child run_command(bool elevated, bool interactive, const std::string &cmd, boost::filesystem::path &working_dir, const boost::process::v1::environment &env, FILE *file, std::error_code &ec, boost::process::v1::group *group);
 
   enum class thread_priority_e : int {
@@ -725,6 +731,29 @@ namespace platf {
    */
   bool process_group_running(std::uintptr_t native_handle);
 
+  /**
+   * @brief Watches a child process from a background thread.
+   */
+  class process_monitor_t {
+  public:
+    virtual ~process_monitor_t() = default;
+
+    /**
+     * @brief Check whether the process exited, without any system calls.
+     * @return `true` once the process exited, or if it can no longer be watched.
+     */
+    virtual bool exited() const = 0;
+  };
+
+  /**
+   * @brief Start watching a child process for its exit.
+   * @details While the process runs, the monitor also reaps other children (e.g. detached commands),
+   *          so callers don't have to poll for them.
+   * @param native_handle The native handle of the child process.
+   * @return The monitor, or `nullptr` if the platform can't watch processes and callers have to poll.
+   */
+  std::unique_ptr<process_monitor_t> monitor_process(std::uintptr_t native_handle);
+
   input_t input();
   /**
    * @brief Get the current mouse position on screen
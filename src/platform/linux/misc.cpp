@@ -9,15 +9,29 @@
 #endif
 
 // standard includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
 
 // platform includes
 #include <arpa/inet.h>
 #include <dlfcn.h>
 #include <ifaddrs.h>
 #include <netinet/udp.h>
+#include <poll.h>
 #include <pwd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
 
 // lib includes
 #include <boost/asio/ip/address.hpp>
@@ -37,6 +51,10 @@
 
 #include <linux/rtnetlink.h>
 
+#ifndef SYS_pidfd_open
+  #define SYS_pidfd_open 434
+#endif
+
 #ifdef __GNUC__
   #define SUNSHINE_GNUC_EXTENSION __extension__
 #else
@@ -214,7 +232,78 @@ namespace platf {
     return {port, std::string {data}};
   }
 
-  std::string get_mac_address(const std::string_view &address) {
+  /**
+   * @brief Counts changes to network links, addresses and routes.
+   * @details Lookups of network configuration are cached until the next change is reported by netlink.
+   */
+  class netlink_watcher_t {
+  public:
+    netlink_watcher_t() {
+      _fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+      if (_fd < 0) {
+        BOOST_LOG(warning) << "Couldn't watch network changes: "sv << strerror(errno);
+        return;
+      }
+
+      sockaddr_nl addr {};
+      addr.nl_family = AF_NETLINK;
+      addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+      if (::bind(_fd, (sockaddr *) &addr, sizeof(addr)) < 0) {
+        BOOST_LOG(warning) << "Couldn't watch network changes: "sv << strerror(errno);
+        close(_fd);
+        _fd = -1;
+        return;
+      }
+
+      _watching = true;
+      std::thread {&netlink_watcher_t::run, this}.detach();
+    }
+
+    /**
+     * @brief Get the number of changes seen so far.
+     * @return The change count, or `std::nullopt` if changes can't be watched and nothing should be cached.
+     */
+    std::optional<std::uint64_t> generation() const {
+      if (!_watching) {
+        return std::nullopt;
+      }
+
+      return _generation.load();
+    }
+
+  private:
+    void run() {
+      std::array<char, 8192> buffer;
+      while (true) {
+        auto len = recv(_fd, buffer.data(), buffer.size(), 0);
+        if (len < 0 && errno == EINTR) {
+          continue;
+        }
+
+        // ENOBUFS means notifications were dropped, which counts as a change too
+        if (len < 0 && errno != ENOBUFS) {
+          BOOST_LOG(warning) << "Stopped watching network changes: "sv << strerror(errno);
+          _watching = false;
+          return;
+        }
+
+        ++_generation;
+      }
+    }
+
+    int _fd = -1;
+    std::atomic_bool _watching {false};
+    std::atomic<std::uint64_t> _generation {0};
+  };
+
+  netlink_watcher_t &netlink_watcher() {
+    // Lives for the rest of the process, its thread blocks in recv()
+    static auto *watcher = new netlink_watcher_t;
+
+    return *watcher;
+  }
+
+  std::string lookup_mac_address(const std::string_view &address) {
     auto ifaddrs = get_ifaddrs();
     for (auto pos = ifaddrs.get(); pos != nullptr; pos = pos->ifa_next) {
       if (pos->ifa_addr && address == from_sockaddr(pos->ifa_addr)) {
@@ -231,7 +320,7 @@ namespace platf {
     return "00:00:00:00:00:00"s;
   }
 
-std::string get_local_ip_for_gateway() {
+std::string lookup_local_ip_for_gateway() {
   int fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
   if (fd < 0) {
     BOOST_LOG(warning) << "Socket creation failed: " << strerror(errno);
@@ -311,6 +400,62 @@ std::string get_local_ip_for_gateway() {
   return local_ip;
 }
 
+  std::string get_mac_address(const std::string_view &address) {
+    static std::mutex cache_lock;
+    static std::map<std::string, std::string, std::less<>> cache;
+    static std::uint64_t cache_generation = 0;
+
+    auto generation = netlink_watcher().generation();
+    if (generation) {
+      std::lock_guard lg {cache_lock};
+      if (cache_generation != *generation) {
+        cache.clear();
+        cache_generation = *generation;
+      }
+
+      if (auto it = cache.find(address); it != std::end(cache)) {
+        return it->second;
+      }
+    }
+
+    auto mac_address = lookup_mac_address(address);
+
+    if (generation) {
+      std::lock_guard lg {cache_lock};
+
+      // Don't cache a result that may predate a change seen in the meantime
+      if (cache_generation == *generation) {
+        cache.emplace(address, mac_address);
+      }
+    }
+
+    return mac_address;
+  }
+
+  std::string get_local_ip_for_gateway() {
+    static std::mutex cache_lock;
+    static std::optional<std::string> cache;
+    static std::uint64_t cache_generation = 0;
+
+    auto generation = netlink_watcher().generation();
+    if (generation) {
+      std::lock_guard lg {cache_lock};
+      if (cache && cache_generation == *generation) {
+        return *cache;
+      }
+    }
+
+    auto local_ip = lookup_local_ip_for_gateway();
+
+    if (generation) {
+      std::lock_guard lg {cache_lock};
+      cache = local_ip;
+      cache_generation = *generation;
+    }
+
+    return local_ip;
+  }
+
   bp::child run_command(bool elevated, bool interactive, const std::string &cmd, boost::filesystem::path &working_dir, const bp::environment &env, FILE *file, std::error_code &ec, bp::group *group) {
     // clang-format off
     if (!group) {
@@ -414,6 +559,99 @@ std::string get_local_ip_for_gateway() {
     return waitpid(-((pid_t) native_handle), nullptr, WNOHANG) >= 0;
   }
 
+  class pidfd_monitor_t: public process_monitor_t {
+  public:
+    pidfd_monitor_t(pid_t pid, int pidfd, int stopfd):
+        _pid {pid},
+        _pidfd {pidfd},
+        _stopfd {stopfd} {
+      _thread = std::thread {&pidfd_monitor_t::run, this};
+    }
+
+    ~pidfd_monitor_t() override {
+      std::uint64_t stop = 1;
+      while (write(_stopfd, &stop, sizeof(stop)) < 0 && errno == EINTR);
+
+      _thread.join();
+
+      close(_pidfd);
+      close(_stopfd);
+    }
+
+    bool exited() const override {
+      return _exited;
+    }
+
+  private:
+    void run() {
+      std::array<pollfd, 2> fds {{
+        {_pidfd, POLLIN, 0},
+        {_stopfd, POLLIN, 0},
+      }};
+
+      while (true) {
+        reap_others();
+
+        // Wake up once in a while for children that exited in the meantime
+        auto res = poll(fds.data(), fds.size(), 1000);
+        if (res < 0 && errno != EINTR) {
+          BOOST_LOG(warning) << "Couldn't watch process ["sv << _pid << "]: "sv << strerror(errno);
+          _exited = true;
+          return;
+        }
+
+        if (fds[1].revents) {
+          return;
+        }
+
+        if (fds[0].revents) {
+          BOOST_LOG(debug) << "Process ["sv << _pid << "] exited"sv;
+          _exited = true;
+          return;
+        }
+      }
+    }
+
+    /**
+     * @brief Reap exited children, except for the watched process which belongs to boost::process.
+     */
+    void reap_others() {
+      while (true) {
+        siginfo_t info {};
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) || !info.si_pid || info.si_pid == _pid) {
+          return;
+        }
+
+        waitpid(info.si_pid, nullptr, WNOHANG);
+      }
+    }
+
+    pid_t _pid;
+    int _pidfd;
+    int _stopfd;
+    std::atomic_bool _exited {false};
+    std::thread _thread;
+  };
+
+  std::unique_ptr<process_monitor_t> monitor_process(std::uintptr_t native_handle) {
+    auto pid = (pid_t) native_handle;
+
+    int pidfd = (int) syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd < 0) {
+      // Requires Linux 5.3
+      BOOST_LOG(debug) << "pidfd_open() failed: "sv << strerror(errno);
+      return nullptr;
+    }
+
+    int stopfd = eventfd(0, EFD_CLOEXEC);
+    if (stopfd < 0) {
+      close(pidfd);
+      return nullptr;
+    }
+
+    return std::make_unique<pidfd_monitor_t>(pid, pidfd, stopfd);
+  }
+
   struct sockaddr_in to_sockaddr(boost::asio::ip::address_v4 address, uint16_t port) {
     struct sockaddr_in saddr_v4 = {};
 
@@ -943,6 +1181,51 @@ std::string get_local_ip_for_gateway() {
     return true;
   }
 
+  std::string gpu_environment_id() {
+    namespace fs = std::filesystem;
+
+    auto read_line = [](const fs::path &path) {
+      std::string line;
+      std::ifstream in(path);
+      std::getline(in, line);
+      return line;
+    };
+
+    std::stringstream id;
+
+    // In-tree drivers are versioned along with the kernel
+    utsname kernel;
+    if (!uname(&kernel)) {
+      id << kernel.release << ';';
+    }
+
+    // Every GPU that can be used for encoding has a render node
+    std::error_code ec;
+    std::vector<fs::path> render_nodes;
+    for (auto &entry : fs::directory_iterator {"/sys/class/drm", ec}) {
+      if (entry.path().filename().string().starts_with("renderD")) {
+        render_nodes.emplace_back(entry.path());
+      }
+    }
+    std::sort(std::begin(render_nodes), std::end(render_nodes));
+
+    for (auto &node : render_nodes) {
+      auto device = node / "device";
+      auto driver = fs::read_symlink(device / "driver", ec).filename().string();
+
+      id << node.filename().string() << ':'
+         << read_line(device / "vendor") << ':'
+         << read_line(device / "device") << ':'
+         << driver << ':'
+         << read_line(fs::path {"/sys/module"} / driver / "version") << ';';
+    }
+
+    // Out-of-tree NVIDIA drivers report their version separately
+    id << read_line("/proc/driver/nvidia/version");
+
+    return id.str();
+  }
+
   std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
 #ifdef SUNSHINE_BUILD_CUDA
     if (sources[source::NVFBC] && hwdevice_type == mem_type_e::cuda) {
@@ -2,6 +2,9 @@
  * @file src/platform/macos/display.mm
  * @brief Definitions for display capture on macOS.
  */
+// platform includes
+#include <sys/sysctl.h>
+
 // local includes
 #include "src/config.h"
 #include "src/logging.h"
@@ -215,4 +218,15 @@ namespace platf {
     // We don't track GPU state, so we will always reenumerate. Fortunately, it is fast on macOS.
     return true;
   }
+
+  std::string gpu_environment_id() {
+    // VideoToolbox and the GPU drivers are updated along with the OS
+    char os_build[64] {};
+    auto size = sizeof(os_build);
+    if (sysctlbyname("kern.osversion", os_build, &size, nullptr, 0)) {
+      return {};
+    }
+
+    return os_build;
+  }
 }  // namespace platf
@@ -276,6 +276,11 @@ namespace platf {
     return waitpid(-((pid_t) native_handle), nullptr, WNOHANG) >= 0;
   }
 
+  std::unique_ptr<process_monitor_t> monitor_process(std::uintptr_t native_handle) {
+    // Unimplemented
+    return nullptr;
+  }
+
   struct sockaddr_in to_sockaddr(boost::asio::ip::address_v4 address, uint16_t port) {
     struct sockaddr_in saddr_v4 = {};
 
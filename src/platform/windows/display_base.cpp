@@ -4,6 +4,7 @@
  */
 // standard includes
 #include <cmath>
+#include <sstream>
 #include <thread>
 
 // platform includes
@@ -1117,4 +1118,33 @@ namespace platf {
       return false;
     }
   }
+
+  std::string gpu_environment_id() {
+    dxgi::factory1_t factory;
+    auto status = CreateDXGIFactory1(IID_IDXGIFactory1, (void **) &factory);
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to create DXGIFactory1 [0x"sv << util::hex(status).to_string_view() << ']';
+      return {};
+    }
+
+    std::stringstream id;
+
+    dxgi::adapter_t adapter;
+    for (int x = 0; factory->EnumAdapters1(x, &adapter) != DXGI_ERROR_NOT_FOUND; ++x) {
+      DXGI_ADAPTER_DESC1 adapter_desc;
+      adapter->GetDesc1(&adapter_desc);
+
+      // The user mode driver version is only reported through this legacy query
+      LARGE_INTEGER driver_version {};
+      adapter->CheckInterfaceSupport(IID_IDXGIDevice, &driver_version);
+
+      id << util::hex(adapter_desc.VendorId).to_string_view() << ':'
+         << util::hex(adapter_desc.DeviceId).to_string_view() << ':'
+         << util::hex(adapter_desc.SubSysId).to_string_view() << ':'
+         << util::hex(adapter_desc.Revision).to_string_view() << ':'
+         << driver_version.QuadPart << ';';
+    }
+
+    return id.str();
+  }
 }  // namespace platf
@@ -1372,6 +1372,11 @@ namespace platf {
     return accounting_info.ActiveProcesses != 0;
   }
 
+  std::unique_ptr<process_monitor_t> monitor_process(std::uintptr_t native_handle) {
+    // Checking the process and its job object is cheap here, there's no reaping to do
+    return nullptr;
+  }
+
   SOCKADDR_IN to_sockaddr(boost::asio::ip::address_v4 address, uint16_t port) {
     SOCKADDR_IN saddr_v4 = {};
 
@@ -5,9 +5,15 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <algorithm>
+#include <atomic>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 // lib includes
@@ -53,6 +59,7 @@ namespace proc {
   namespace pt = boost::property_tree;
 
   proc_t proc;
+  std::atomic<uint32_t> app_list_generation {0};
 
   int input_only_app_id = -1;
   std::string input_only_app_id_str;
@@ -427,6 +434,8 @@ namespace proc {
         BOOST_LOG(warning) << "Couldn't run ["sv << _app.cmd << "]: System: "sv << ec.message();
         return -1;
       }
+
+      std::atomic_store(&_process_monitor, std::shared_ptr<platf::process_monitor_t> {platf::monitor_process((std::uintptr_t) _process.native_handle())});
     }
 
     _app_launch_time = std::chrono::steady_clock::now();
@@ -497,6 +506,12 @@ namespace proc {
   }
 
   int proc_t::running() {
+    // Nothing to check until the monitor sees the app exit, the copy keeps it alive if terminate() runs meanwhile
+    auto process_monitor = std::atomic_load(&_process_monitor);
+    if (process_monitor && !process_monitor->exited()) {
+      return _app_id;
+    }
+
 #ifndef _WIN32
     // On POSIX OSes, we must periodically wait for our children to avoid
     // them becoming zombies. This must be synchronized carefully with
@@ -541,6 +556,9 @@ namespace proc {
     std::error_code ec;
     placebo = false;
 
+    // Readers that still hold the monitor keep it alive, the last one to let go stops it
+    std::atomic_exchange(&_process_monitor, std::shared_ptr<platf::process_monitor_t> {});
+
     if (!immediate) {
       terminate_process_group(_process, _process_group, _app.exit_timeout);
     }
@@ -648,7 +666,7 @@ namespace proc {
   // Returns default image if image configuration is not set.
   // Returns http content-type header compatible image type.
   std::string proc_t::get_app_image(int app_id) {
-    auto iter = std::find_if(_apps.begin(), _apps.end(), [&app_id](const auto app) {
+    auto iter = std::find_if(_apps.begin(), _apps.end(), [&app_id](const auto &app) {
       return app.id == std::to_string(app_id);
     });
     auto app_image_path = iter == _apps.end() ? std::string() : iter->image_path;
@@ -824,6 +842,101 @@ namespace proc {
     return ss.str();
   }
 
+  struct image_hash_t {
+    std::filesystem::file_time_type mtime;
+    std::uintmax_t size;
+    std::optional<std::string> hash;
+  };
+
+  // Hashes of app images, so refreshing the app list only reads images that changed
+  std::mutex image_hashes_lock;
+  std::unordered_map<std::string, image_hash_t> image_hashes;
+
+  // Hashing is disk bound, more threads than this only contend for the same drive
+  constexpr std::size_t MAX_IMAGE_HASH_THREADS = 4;
+
+  /**
+   * @brief Get the SHA-256 of an app image, reusing the previous result while its size and mtime are unchanged.
+   * @param filename The image file.
+   * @param cached_only If `true`, return `std::nullopt` instead of hashing an image that isn't cached.
+   * @return The hash, or `std::nullopt` if the image couldn't be hashed.
+   */
+  std::optional<std::string> calculate_image_sha256(const std::string &filename, bool cached_only = false) {
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(filename, ec);
+    auto size = ec ? 0 : std::filesystem::file_size(filename, ec);
+    if (ec) {
+      return cached_only ? std::nullopt : calculate_sha256(filename);
+    }
+
+    {
+      std::lock_guard lg {image_hashes_lock};
+      auto it = image_hashes.find(filename);
+      if (it != std::end(image_hashes) && it->second.mtime == mtime && it->second.size == size) {
+        return it->second.hash;
+      }
+    }
+
+    if (cached_only) {
+      return std::nullopt;
+    }
+
+    auto hash = calculate_sha256(filename);
+
+    std::lock_guard lg {image_hashes_lock};
+    image_hashes.insert_or_assign(filename, image_hash_t {mtime, size, hash});
+
+    return hash;
+  }
+
+  /**
+   * @brief Hash app images that changed since they were last hashed, using several threads.
+   * @details Hashes of images that are no longer used by any app are dropped.
+   * @param image_paths The configured image paths of the apps.
+   */
+  void hash_app_images(const std::vector<std::string> &image_paths) {
+    std::set<std::string> used;
+    std::vector<std::string> pending;
+    for (auto &image_path : image_paths) {
+      auto file_path = validate_app_image_path(image_path);
+      if (file_path == DEFAULT_APP_IMAGE_PATH || !used.emplace(file_path).second) {
+        continue;
+      }
+
+      if (!calculate_image_sha256(file_path, true)) {
+        pending.emplace_back(std::move(file_path));
+      }
+    }
+
+    {
+      std::lock_guard lg {image_hashes_lock};
+      std::erase_if(image_hashes, [&used](const auto &entry) {
+        return !used.contains(entry.first);
+      });
+    }
+
+    if (pending.empty()) {
+      return;
+    }
+
+    auto thread_count = std::min({pending.size(), MAX_IMAGE_HASH_THREADS, (std::size_t) std::max(std::thread::hardware_concurrency(), 1u)});
+    BOOST_LOG(debug) << "Hashing "sv << pending.size() << " app images on "sv << thread_count << " threads"sv;
+
+    std::atomic_size_t next {0};
+    std::vector<std::thread> threads;
+    for (std::size_t x = 0; x < thread_count; ++x) {
+      threads.emplace_back([&]() {
+        for (auto y = next++; y < pending.size(); y = next++) {
+          calculate_image_sha256(pending[y]);
+        }
+      });
+    }
+
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+
   uint32_t calculate_crc32(const std::string &input) {
     boost::crc_32_type result;
     result.process_bytes(input.data(), input.length());
@@ -836,7 +949,7 @@ namespace proc {
     to_hash.push_back(app_name);
     auto file_path = validate_app_image_path(app_image_path);
     if (file_path != DEFAULT_APP_IMAGE_PATH) {
-      auto file_hash = calculate_sha256(file_path);
+      auto file_hash = calculate_image_sha256(file_path);
       if (file_hash) {
         to_hash.push_back(file_hash.value());
       } else {
@@ -1039,6 +1152,23 @@ namespace proc {
         return std::nullopt;
       }
 
+      // The app ids depend on the images, hash them all up front
+      {
+        std::vector<std::string> image_paths;
+        for (auto &app_node : tree["apps"]) {
+          if (app_node.contains("image-path")) {
+            image_paths.emplace_back(parse_env_val(this_env, app_node.value("image-path", "")));
+          }
+        }
+
+        // The built-in apps added below are hashed too, or their cached hashes would be pruned on every refresh
+        for (auto image_path : {"input_only.png", "terminate.png", "virtual_desktop.png"}) {
+          image_paths.emplace_back(parse_env_val(this_env, image_path));
+        }
+
+        hash_app_images(image_paths);
+      }
+
       // Iterate over each application in the "apps" array.
       for (auto &app_node : tree["apps"]) {
         proc::ctx_t ctx;
@@ -1249,5 +1379,7 @@ namespace proc {
     if (proc_opt) {
       proc = std::move(*proc_opt);
     }
+
+    ++app_list_generation;
   }
 }  // namespace proc
@@ -9,6 +9,8 @@
 #endif
 
 // standard includes
+#include <atomic>
+#include <memory>
 #include <optional>
 #include <unordered_map>
 
@@ -142,6 +144,10 @@ namespace proc {
     boost::process::v1::child _process;
     boost::process::v1::group _process_group;
 
+    // Reports the exit of _process, so running() doesn't have to poll while the app runs.
+    // Only accessed through std::atomic_load/store/exchange, running() is called from other threads than terminate().
+    std::shared_ptr<platf::process_monitor_t> _process_monitor;
+
     file_t _pipe;
     std::vector<cmd_t>::const_iterator _app_prep_it;
     std::vector<cmd_t>::const_iterator _app_prep_begin;
@@ -177,6 +183,11 @@ namespace proc {
 
   extern proc_t proc;
 
+  /**
+   * @brief Incremented each time the app list is reloaded by `refresh()`.
+   */
+  extern std::atomic<uint32_t> app_list_generation;
+
   extern int input_only_app_id;
   extern std::string input_only_app_id_str;
   extern int terminate_app_id;
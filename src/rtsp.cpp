@@ -10,11 +10,19 @@ extern "C" {
 }
 
 // standard includes
+#include <algorithm>
 #include <array>
 #include <cctype>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <set>
+#include <sstream>
+#include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 // lib includes
 #include <boost/asio.hpp>
@@ -77,17 +85,18 @@ namespace rtsp_stream {
 #pragma pack(pop)
 
   class rtsp_server_t;
+  class socket_t;
 
   using msg_t = util::safe_ptr<RTSP_MESSAGE, free_msg>;
-  using cmd_func_t = std::function<void(rtsp_server_t *server, tcp::socket &, launch_session_t &, msg_t &&)>;
+  using cmd_func_t = std::function<void(rtsp_server_t *server, socket_t &, launch_session_t &, msg_t &&)>;
 
   void print_msg(PRTSP_MESSAGE msg);
-  void cmd_not_found(tcp::socket &sock, launch_session_t &, msg_t &&req);
-  void respond(tcp::socket &sock, launch_session_t &session, POPTION_ITEM options, int statuscode, const char *status_msg, int seqn, const std::string_view &payload);
+  void cmd_not_found(socket_t &sock, launch_session_t &, msg_t &&req);
+  void respond(socket_t &sock, launch_session_t &session, POPTION_ITEM options, int statuscode, const char *status_msg, int seqn, const std::string_view &payload);
 
   class socket_t: public std::enable_shared_from_this<socket_t> {
   public:
-    socket_t(boost::asio::io_context &io_context, std::function<void(tcp::socket &sock, launch_session_t &, msg_t &&)> &&handle_data_fn):
+    socket_t(boost::asio::io_context &io_context, std::function<void(socket_t &sock, launch_session_t &, msg_t &&)> &&handle_data_fn):
         handle_data_fn {std::move(handle_data_fn)},
         sock {io_context} {
     }
@@ -99,10 +108,8 @@ namespace rtsp_stream {
       if (begin == std::end(msg_buf) || (session->rtsp_cipher && begin + sizeof(encrypted_rtsp_header_t) >= std::end(msg_buf))) {
         BOOST_LOG(error) << "RTSP: read(): Exceeded maximum rtsp packet size: "sv << msg_buf.size();
 
-        respond(sock, *session, nullptr, 400, "BAD REQUEST", 0, {});
-
-        boost::system::error_code ec;
-        sock.close(ec);
+        respond(*this, *session, nullptr, 400, "BAD REQUEST", 0, {});
+        close();
 
         return;
       }
@@ -133,18 +140,13 @@ namespace rtsp_stream {
       BOOST_LOG(debug) << "handle_read_encrypted_header(): Handle read of size: "sv << bytes << " bytes"sv;
 
       auto sock_close = util::fail_guard([&socket]() {
-        boost::system::error_code ec;
-        socket->sock.close(ec);
-
-        if (ec) {
-          BOOST_LOG(error) << "RTSP: handle_read_encrypted_header(): Couldn't close tcp socket: "sv << ec.message();
-        }
+        socket->close();
       });
 
       if (ec || bytes < sizeof(encrypted_rtsp_header_t)) {
         BOOST_LOG(error) << "RTSP: handle_read_encrypted_header(): Couldn't read from tcp socket: "sv << ec.message();
 
-        respond(socket->sock, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
+        respond(*socket, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
         return;
       }
 
@@ -152,7 +154,7 @@ namespace rtsp_stream {
       if (!header->is_encrypted()) {
         BOOST_LOG(error) << "RTSP: handle_read_encrypted_header(): Rejecting unencrypted RTSP message"sv;
 
-        respond(socket->sock, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
+        respond(*socket, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
         return;
       }
 
@@ -162,7 +164,7 @@ namespace rtsp_stream {
       if (socket->begin + sizeof(*header) + payload_length >= std::end(socket->msg_buf)) {
         BOOST_LOG(error) << "RTSP: handle_read_encrypted_header(): Exceeded maximum rtsp packet size: "sv << socket->msg_buf.size();
 
-        respond(socket->sock, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
+        respond(*socket, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
         return;
       }
 
@@ -182,12 +184,7 @@ namespace rtsp_stream {
       BOOST_LOG(debug) << "handle_read_encrypted(): Handle read of size: "sv << bytes << " bytes"sv;
 
       auto sock_close = util::fail_guard([&socket]() {
-        boost::system::error_code ec;
-        socket->sock.close(ec);
-
-        if (ec) {
-          BOOST_LOG(error) << "RTSP: handle_read_encrypted_message(): Couldn't close tcp socket: "sv << ec.message();
-        }
+        socket->close();
       });
 
       auto header = (encrypted_rtsp_header_t *) socket->begin;
@@ -197,7 +194,7 @@ namespace rtsp_stream {
       if (ec || bytes < payload_length) {
         BOOST_LOG(error) << "RTSP: handle_read_encrypted(): Couldn't read from tcp socket: "sv << ec.message();
 
-        respond(socket->sock, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
+        respond(*socket, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
         return;
       }
 
@@ -218,7 +215,7 @@ namespace rtsp_stream {
       if (socket->session->rtsp_cipher->decrypt(std::string_view {(const char *) header->tag, sizeof(header->tag) + bytes}, plaintext, &iv)) {
         BOOST_LOG(error) << "Failed to verify RTSP message tag"sv;
 
-        respond(socket->sock, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
+        respond(*socket, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
         return;
       }
 
@@ -226,7 +223,7 @@ namespace rtsp_stream {
       if (auto status = parseRtspMessage(req.get(), (char *) plaintext.data(), plaintext.size())) {
         BOOST_LOG(error) << "Malformed RTSP message: ["sv << status << ']';
 
-        respond(socket->sock, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
+        respond(*socket, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
         return;
       }
 
@@ -244,10 +241,8 @@ namespace rtsp_stream {
       if (begin == std::end(msg_buf)) {
         BOOST_LOG(error) << "RTSP: read_plaintext_payload(): Exceeded maximum rtsp packet size: "sv << msg_buf.size();
 
-        respond(sock, *session, nullptr, 400, "BAD REQUEST", 0, {});
-
-        boost::system::error_code ec;
-        sock.close(ec);
+        respond(*this, *session, nullptr, 400, "BAD REQUEST", 0, {});
+        close();
 
         return;
       }
@@ -273,12 +268,7 @@ namespace rtsp_stream {
       BOOST_LOG(debug) << "handle_plaintext_payload(): Handle read of size: "sv << bytes << " bytes"sv;
 
       auto sock_close = util::fail_guard([&socket]() {
-        boost::system::error_code ec;
-        socket->sock.close(ec);
-
-        if (ec) {
-          BOOST_LOG(error) << "RTSP: handle_plaintext_payload(): Couldn't close tcp socket: "sv << ec.message();
-        }
+        socket->close();
       });
 
       if (ec) {
@@ -292,7 +282,7 @@ namespace rtsp_stream {
       if (auto status = parseRtspMessage(req.get(), socket->msg_buf.data(), (std::size_t)(end - socket->msg_buf.data()))) {
         BOOST_LOG(error) << "Malformed RTSP message: ["sv << status << ']';
 
-        respond(socket->sock, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
+        respond(*socket, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
         return;
       }
 
@@ -345,13 +335,7 @@ namespace rtsp_stream {
       if (ec) {
         BOOST_LOG(error) << "RTSP: handle_read_plaintext(): Couldn't read from tcp socket: "sv << ec.message();
 
-        boost::system::error_code ec;
-        socket->sock.close(ec);
-
-        if (ec) {
-          BOOST_LOG(error) << "RTSP: handle_read_plaintext(): Couldn't close tcp socket: "sv << ec.message();
-        }
-
+        socket->close();
         return;
       }
 
@@ -382,10 +366,35 @@ namespace rtsp_stream {
     }
 
     void handle_data(msg_t &&req) {
-      handle_data_fn(sock, *session, std::move(req));
+      handle_data_fn(*this, *session, std::move(req));
     }
 
-    std::function<void(tcp::socket &sock, launch_session_t &, msg_t &&)> handle_data_fn;
+    /**
+     * @brief Queue a message to be sent after the ones already queued.
+     * @details The write is asynchronous, so a peer that doesn't read can't tie up the thread handling it.
+     * @param message The complete message.
+     */
+    void write(std::vector<std::uint8_t> &&message) {
+      std::lock_guard lg {write_lock};
+      write_queue.emplace_back(std::move(message));
+      if (write_queue.size() == 1) {
+        write_next();
+      }
+    }
+
+    /**
+     * @brief Close the connection once the queued messages are sent.
+     */
+    void close() {
+      std::lock_guard lg {write_lock};
+      if (write_queue.empty()) {
+        close_now();
+      } else {
+        close_pending = true;
+      }
+    }
+
+    std::function<void(socket_t &sock, launch_session_t &, msg_t &&)> handle_data_fn;
 
     tcp::socket sock;
 
@@ -395,6 +404,43 @@ namespace rtsp_stream {
     char *begin = msg_buf.data();
 
     std::shared_ptr<launch_session_t> session;
+
+  private:
+    /**
+     * @brief Start writing the oldest queued message.
+     * @note The caller holds `write_lock`.
+     */
+    void write_next() {
+      // The pending write keeps the connection alive, even once no more reads are queued
+      boost::asio::async_write(sock, boost::asio::buffer(write_queue.front()), [self = shared_from_this()](const boost::system::error_code &ec, std::size_t) {
+        std::lock_guard lg {self->write_lock};
+        self->write_queue.pop_front();
+
+        if (ec) {
+          BOOST_LOG(error) << "RTSP: Couldn't send data over tcp socket: "sv << ec.message();
+          self->write_queue.clear();
+        }
+
+        if (!self->write_queue.empty()) {
+          self->write_next();
+        } else if (self->close_pending) {
+          self->close_now();
+        }
+      });
+    }
+
+    void close_now() {
+      boost::system::error_code ec;
+      sock.close(ec);
+
+      if (ec) {
+        BOOST_LOG(error) << "RTSP: Couldn't close tcp socket: "sv << ec.message();
+      }
+    }
+
+    std::mutex write_lock;
+    std::deque<std::vector<std::uint8_t>> write_queue;
+    bool close_pending = false;
   };
 
   class rtsp_server_t {
@@ -421,7 +467,7 @@ namespace rtsp_stream {
         return -1;
       }
 
-      next_socket = std::make_shared<socket_t>(io_context, [this](tcp::socket &sock, launch_session_t &session, msg_t &&msg) {
+      next_socket = std::make_shared<socket_t>(io_context, [this](socket_t &sock, launch_session_t &session, msg_t &&msg) {
         handle_msg(sock, session, std::move(msg));
       });
 
@@ -432,21 +478,90 @@ namespace rtsp_stream {
       return 0;
     }
 
-    template<class T, class X>
-    void iterate(std::chrono::duration<T, X> timeout) {
-      io_context.run_one_for(timeout);
+    /**
+     * @brief Start handling connections on a pool of threads.
+     * @details Each connection is handled by a single thread at a time, so the handshake of one client
+     *          (e.g. an ANNOUNCE bringing up the stream) doesn't hold up others.
+     * @param threads The number of threads.
+     */
+    void start(std::size_t threads) {
+      work_guard.emplace(io_context.get_executor());
+
+      for (std::size_t x = 0; x < threads; ++x) {
+        io_threads.emplace_back([this]() {
+          io_context.run();
+        });
+      }
     }
 
-    void handle_msg(tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+    /**
+     * @brief Stop handling connections and wait for the threads to finish.
+     */
+    void stop() {
+      work_guard.reset();
+      io_context.stop();
+
+      for (auto &thread : io_threads) {
+        thread.join();
+      }
+      io_threads.clear();
+    }
+
+    void handle_msg(socket_t &sock, launch_session_t &session, msg_t &&req) {
       auto func = _map_cmd_cb.find(req->message.request.command);
       if (func != std::end(_map_cmd_cb)) {
+        auto start = std::chrono::steady_clock::now();
         func->second(this, sock, session, std::move(req));
+        record_phase(func->first, std::chrono::steady_clock::now() - start);
       } else {
         cmd_not_found(sock, session, std::move(req));
       }
 
-      boost::system::error_code ec;
-      sock.shutdown(boost::asio::socket_base::shutdown_type::shutdown_both, ec);
+      sock.close();
+    }
+
+    /**
+     * @brief Record how long a handshake phase took to handle.
+     * @param command The RTSP command of the phase.
+     * @param duration The time spent in the handler.
+     */
+    void record_phase(const std::string_view &command, std::chrono::steady_clock::duration duration) {
+      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+      BOOST_LOG(verbose) << "RTSP: "sv << command << " took "sv << ms << "ms"sv;
+
+      auto lg = _phase_times.lock();
+
+      // Bucket x counts phases that took less than 2^x ms, the last one everything longer
+      auto &buckets = (*_phase_times)[command];
+      std::size_t bucket = 0;
+      while (bucket < buckets.size() - 1 && ms >= (1 << bucket)) {
+        ++bucket;
+      }
+      ++buckets[bucket];
+
+      // PLAY completes the handshake
+      if (command != "PLAY"sv) {
+        return;
+      }
+
+      std::stringstream ss;
+      for (auto &[phase, counts] : *_phase_times) {
+        ss << std::endl
+           << phase << ':';
+        auto last = counts.size() - 1;
+        for (std::size_t x = 0; x < counts.size(); ++x) {
+          if (!counts[x]) {
+            continue;
+          }
+
+          if (x < last) {
+            ss << " <"sv << (1 << x) << "ms: "sv << counts[x];
+          } else {
+            ss << " >="sv << (1 << (last - 1)) << "ms: "sv << counts[x];
+          }
+        }
+      }
+      BOOST_LOG(debug) << "RTSP handshake phase times:"sv << ss.str();
     }
 
     void handle_accept(const boost::system::error_code &ec) {
@@ -475,7 +590,7 @@ namespace rtsp_stream {
       }
 
       // Queue another asynchronous accept for the next incoming connection
-      next_socket = std::make_shared<socket_t>(io_context, [this](tcp::socket &sock, launch_session_t &session, msg_t &&msg) {
+      next_socket = std::make_shared<socket_t>(io_context, [this](socket_t &sock, launch_session_t &session, msg_t &&msg) {
         handle_msg(sock, session, std::move(msg));
       });
       acceptor.async_accept(next_socket->sock, [this](const auto &ec) {
@@ -615,9 +730,14 @@ namespace rtsp_stream {
 
     std::chrono::steady_clock::time_point raised_timeout;
 
+    sync_util::sync_t<std::map<std::string_view, std::array<std::uint32_t, 12>>> _phase_times;
+
     boost::asio::io_context io_context;
     tcp::acceptor acceptor {io_context};
 
+    std::optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work_guard;
+    std::vector<std::thread> io_threads;
+
     std::shared_ptr<socket_t> next_socket;
   };
 
@@ -650,23 +770,7 @@ namespace rtsp_stream {
     server.clear(true);
   }
 
-  int send(tcp::socket &sock, const std::string_view &sv) {
-    std::size_t bytes_send = 0;
-
-    while (bytes_send != sv.size()) {
-      boost::system::error_code ec;
-      bytes_send += sock.send(boost::asio::buffer(sv.substr(bytes_send)), 0, ec);
-
-      if (ec) {
-        BOOST_LOG(error) << "RTSP: Couldn't send data over tcp socket: "sv << ec.message();
-        return -1;
-      }
-    }
-
-    return 0;
-  }
-
-  void respond(tcp::socket &sock, launch_session_t &session, msg_t &resp) {
+  void respond(socket_t &sock, launch_session_t &session, msg_t &resp) {
     auto payload = std::make_pair(resp->payload, resp->payloadLength);
 
     // Restore response message for proper destruction
@@ -720,32 +824,30 @@ namespace rtsp_stream {
       session.rtsp_cipher->encrypt(std::string_view {(const char *) header->payload(), (std::size_t) payload_length}, header->tag, &iv);
 
       // Send the full encrypted message
-      send(sock, std::string_view {(char *) message.data(), message.size()});
+      sock.write(std::move(message));
     } else {
-      std::string_view tmp_resp {raw_resp.get(), (size_t) serialized_len};
-
-      // Send the plaintext RTSP message header
-      if (send(sock, tmp_resp)) {
-        return;
-      }
+      // Send the plaintext RTSP message header and payload (if present) in one go
+      std::vector<uint8_t> message;
+      message.reserve(serialized_len + payload.second);
+      std::copy_n(raw_resp.get(), serialized_len, std::back_inserter(message));
+      std::copy_n(payload.first, payload.second, std::back_inserter(message));
 
-      // Send the plaintext RTSP message payload (if present)
-      send(sock, std::string_view {payload.first, (std::size_t) payload.second});
+      sock.write(std::move(message));
     }
   }
 
-  void respond(tcp::socket &sock, launch_session_t &session, POPTION_ITEM options, int statuscode, const char *status_msg, int seqn, const std::string_view &payload) {
+  void respond(socket_t &sock, launch_session_t &session, POPTION_ITEM options, int statuscode, const char *status_msg, int seqn, const std::string_view &payload) {
     msg_t resp {new msg_t::element_type};
     createRtspResponse(resp.get(), nullptr, 0, const_cast<char *>("RTSP/1.0"), statuscode, const_cast<char *>(status_msg), seqn, options, const_cast<char *>(payload.data()), (int) payload.size());
 
     respond(sock, session, resp);
   }
 
-  void cmd_not_found(tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+  void cmd_not_found(socket_t &sock, launch_session_t &session, msg_t &&req) {
     respond(sock, session, nullptr, 404, "NOT FOUND", req->sequenceNumber, {});
   }
 
-  void cmd_option(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+  void cmd_option(rtsp_server_t *server, socket_t &sock, launch_session_t &session, msg_t &&req) {
     OPTION_ITEM option {};
 
     // I know these string literals will not be modified
@@ -757,7 +859,7 @@ namespace rtsp_stream {
     respond(sock, session, &option, 200, "OK", req->sequenceNumber, {});
   }
 
-  void cmd_describe(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+  void cmd_describe(rtsp_server_t *server, socket_t &sock, launch_session_t &session, msg_t &&req) {
     OPTION_ITEM option {};
 
     // I know these string literals will not be modified
@@ -776,7 +878,7 @@ namespace rtsp_stream {
     uint32_t encryption_flags_requested = SS_ENC_CONTROL_V2;
 
     // Determine the encryption desired for this remote endpoint
-    auto encryption_mode = net::encryption_mode_for_address(sock.remote_endpoint().address());
+    auto encryption_mode = net::encryption_mode_for_address(sock.sock.remote_endpoint().address());
     if (encryption_mode != config::ENCRYPTION_MODE_NEVER) {
       // Advertise support for video encryption if it's not disabled
       encryption_flags_supported |= SS_ENC_VIDEO;
@@ -840,7 +942,7 @@ namespace rtsp_stream {
     respond(sock, session, &option, 200, "OK", req->sequenceNumber, ss.str());
   }
 
-  void cmd_setup(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+  void cmd_setup(rtsp_server_t *server, socket_t &sock, launch_session_t &session, msg_t &&req) {
     OPTION_ITEM options[4] {};
 
     auto &seqn = options[0];
@@ -899,7 +1001,7 @@ namespace rtsp_stream {
     respond(sock, session, &seqn, 200, "OK", req->sequenceNumber, {});
   }
 
-  void cmd_announce(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+  void cmd_announce(rtsp_server_t *server, socket_t &sock, launch_session_t &session, msg_t &&req) {
     OPTION_ITEM option {};
 
     // I know these string literals will not be modified
@@ -1096,7 +1198,7 @@ namespace rtsp_stream {
     }
 
     // Check that any required encryption is enabled
-    auto encryption_mode = net::encryption_mode_for_address(sock.remote_endpoint().address());
+    auto encryption_mode = net::encryption_mode_for_address(sock.sock.remote_endpoint().address());
     if (encryption_mode == config::ENCRYPTION_MODE_MANDATORY &&
         (config.encryptionFlagsEnabled & (SS_ENC_VIDEO | SS_ENC_AUDIO)) != (SS_ENC_VIDEO | SS_ENC_AUDIO)) {
       BOOST_LOG(error) << "Rejecting client that cannot comply with mandatory encryption requirement"sv;
@@ -1108,7 +1210,7 @@ namespace rtsp_stream {
     auto stream_session = stream::session::alloc(config, session);
     server->insert(stream_session);
 
-    if (stream::session::start(*stream_session, sock.remote_endpoint().address().to_string())) {
+    if (stream::session::start(*stream_session, sock.sock.remote_endpoint().address().to_string())) {
       BOOST_LOG(error) << "Failed to start a streaming session"sv;
 
       server->remove(stream_session);
@@ -1119,7 +1221,7 @@ namespace rtsp_stream {
     respond(sock, session, &option, 200, "OK", req->sequenceNumber, {});
   }
 
-  void cmd_play(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+  void cmd_play(rtsp_server_t *server, socket_t &sock, launch_session_t &session, msg_t &&req) {
     OPTION_ITEM option {};
 
     // I know these string literals will not be modified
@@ -1149,8 +1251,10 @@ namespace rtsp_stream {
       return;
     }
 
+    server.start(std::clamp(std::thread::hardware_concurrency(), 2u, 4u));
+
     while (!shutdown_event->peek()) {
-      server.iterate(std::min(500ms, config::stream.ping_timeout));
+      shutdown_event->view(std::min(500ms, config::stream.ping_timeout));
 
       if (broadcast_shutdown_event->peek()) {
         server.clear();
@@ -1160,6 +1264,7 @@ namespace rtsp_stream {
       }
     }
 
+    server.stop();
     server.clear();
   }
 
@@ -4,9 +4,12 @@
  */
 
 // standard includes
+#include <cstring>
 #include <fstream>
 #include <future>
+#include <numeric>
 #include <queue>
+#include <span>
 
 // lib includes
 #include <boost/endian/arithmetic.hpp>
@@ -257,8 +260,28 @@ namespace stream {
   public:
     int bind(net::af_e address_family, std::uint16_t port) {
       _host = net::host_create(address_family, _addr, port);
+      if (!_host) {
+        return -1;
+      }
+
+      // A datagram sent to ourselves over loopback interrupts iterate() when there is something to send
+      boost::system::error_code ec;
+      _wake_sock.open(udp::v4(), ec);
+      if (!ec) {
+        _wake_sock.bind(udp::endpoint {asio::ip::address_v4::loopback(), 0}, ec);
+      }
+      if (!ec) {
+        _wake_sock.non_blocking(true, ec);
+      }
+      if (!ec) {
+        _wake_endpoint = _wake_sock.local_endpoint(ec);
+      }
+      if (ec) {
+        BOOST_LOG(warning) << "Couldn't create control stream wakeup socket: "sv << ec.message();
+        _wake_sock.close(ec);
+      }
 
-      return !(bool) _host;
+      return 0;
     }
 
     // Get session associated with address.
@@ -273,6 +296,18 @@ namespace stream {
     // Therefore, iterate is implemented further down the source file
     void iterate(std::chrono::milliseconds timeout);
 
+    /**
+     * @brief Make a pending or the next `iterate()` return right away.
+     * @details Called when a message for a client is queued, so it's sent without waiting for the timeout.
+     */
+    void wake();
+
+    /**
+     * @brief Handle a single ENet event.
+     * @param event The event.
+     */
+    void handle_event(ENetEvent &event);
+
     /**
      * @brief Call the handler for a given control stream message.
      * @param type The message type.
@@ -310,8 +345,18 @@ namespace stream {
     // ENet peer to session mapping for sessions with a peer connected
     sync_util::sync_t<std::map<net::peer_t, session_t *>> _peer_to_session;
 
+    // Statistics, only accessed from the control thread
+    std::uint64_t events_processed = 0;
+    std::chrono::steady_clock::duration event_time {};
+
     ENetAddress _addr;
     net::host_t _host;
+
+    asio::io_context _wake_io;
+    udp::socket _wake_sock {_wake_io};
+    udp::endpoint _wake_endpoint;
+    std::atomic_bool _wake_pending {false};
+    std::mutex _wake_lock;
   };
 
   struct broadcast_ctx_t {
@@ -558,43 +603,93 @@ namespace stream {
 
   void control_server_t::iterate(std::chrono::milliseconds timeout) {
     ENetEvent event;
-    auto res = enet_host_service(_host.get(), &event, timeout.count());
-
-    if (res > 0) {
-      auto session = get_session(event.peer, event.data);
-      if (!session) {
-        BOOST_LOG(warning) << "Rejected connection from ["sv << platf::from_sockaddr((sockaddr *) &event.peer->address.address) << "]: it's not properly set up"sv;
-        enet_peer_disconnect_now(event.peer, 0);
+    auto res = enet_host_service(_host.get(), &event, _wake_sock.is_open() ? 0 : timeout.count());
+
+    if (res == 0 && _wake_sock.is_open()) {
+      // Sleep until the client sends something or wake() is called
+      auto wake_fd = (ENetSocket) _wake_sock.native_handle();
+
+      ENetSocketSet read_set;
+      ENET_SOCKETSET_EMPTY(read_set);
+      ENET_SOCKETSET_ADD(read_set, _host->socket);
+      ENET_SOCKETSET_ADD(read_set, wake_fd);
+
+      if (enet_socketset_select(std::max(_host->socket, wake_fd), &read_set, nullptr, timeout.count()) > 0 &&
+          ENET_SOCKETSET_CHECK(read_set, wake_fd)) {
+        std::array<char, 16> buf;
+        udp::endpoint peer;
+        boost::system::error_code ec;
+        while (!ec) {
+          _wake_sock.receive_from(asio::buffer(buf), peer, 0, ec);
+        }
 
-        return;
+        _wake_pending = false;
       }
 
-      session->pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout;
+      res = enet_host_service(_host.get(), &event, 0);
+    }
 
-      switch (event.type) {
-        case ENET_EVENT_TYPE_RECEIVE:
-          {
-            net::packet_t packet {event.packet};
+    // Handle everything ENet has already received, not just the first event
+    while (res > 0) {
+      auto start = std::chrono::steady_clock::now();
+      handle_event(event);
+      event_time += std::chrono::steady_clock::now() - start;
+      ++events_processed;
 
-            auto type = *(std::uint16_t *) packet->data;
-            std::string_view payload {(char *) packet->data + sizeof(type), packet->dataLength - sizeof(type)};
+      res = enet_host_check_events(_host.get(), &event);
+    }
+  }
 
-            call(type, session, payload, false);
-          }
-          break;
-        case ENET_EVENT_TYPE_CONNECT:
-          BOOST_LOG(info) << "CLIENT CONNECTED"sv;
-          break;
-        case ENET_EVENT_TYPE_DISCONNECT:
-          BOOST_LOG(info) << "CLIENT DISCONNECTED"sv;
-          // No more clients to send video data to ^_^
-          if (session->state == session::state_e::RUNNING) {
-            session::stop(*session);
-          }
-          break;
-        case ENET_EVENT_TYPE_NONE:
-          break;
-      }
+  void control_server_t::handle_event(ENetEvent &event) {
+    auto session = get_session(event.peer, event.data);
+    if (!session) {
+      BOOST_LOG(warning) << "Rejected connection from ["sv << platf::from_sockaddr((sockaddr *) &event.peer->address.address) << "]: it's not properly set up"sv;
+      enet_peer_disconnect_now(event.peer, 0);
+
+      return;
+    }
+
+    session->pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout;
+
+    switch (event.type) {
+      case ENET_EVENT_TYPE_RECEIVE:
+        {
+          net::packet_t packet {event.packet};
+
+          auto type = *(std::uint16_t *) packet->data;
+          std::string_view payload {(char *) packet->data + sizeof(type), packet->dataLength - sizeof(type)};
+
+          call(type, session, payload, false);
+        }
+        break;
+      case ENET_EVENT_TYPE_CONNECT:
+        BOOST_LOG(info) << "CLIENT CONNECTED"sv;
+        break;
+      case ENET_EVENT_TYPE_DISCONNECT:
+        BOOST_LOG(info) << "CLIENT DISCONNECTED"sv;
+        // No more clients to send video data to ^_^
+        if (session->state == session::state_e::RUNNING) {
+          session::stop(*session);
+        }
+        break;
+      case ENET_EVENT_TYPE_NONE:
+        break;
+    }
+  }
+
+  void control_server_t::wake() {
+    // One datagram is enough until iterate() has consumed it
+    if (!_wake_sock.is_open() || _wake_pending.exchange(true)) {
+      return;
+    }
+
+    std::lock_guard lg {_wake_lock};
+
+    char wakeup = 0;
+    boost::system::error_code ec;
+    _wake_sock.send_to(asio::buffer(&wakeup, sizeof(wakeup)), _wake_endpoint, 0, ec);
+    if (ec) {
+      _wake_pending = false;
     }
   }
 
@@ -709,65 +804,95 @@ namespace stream {
   }  // namespace fec
 
   /**
-   * @brief Combines two buffers and inserts new buffers at each slice boundary of the result.
+   * @brief Gathers buffers into one and inserts zeroed space at each slice boundary of the result.
    * @param insert_size The number of bytes to insert.
    * @param slice_size The number of bytes between insertions.
-   * @param data1 The first data buffer.
-   * @param data2 The second data buffer.
+   * @param data The buffers to gather, in order.
+   * @param result Receives the result. It is never shrunk, so reusing it for every frame avoids reallocations.
+   * @return The gathered data, a view into `result`.
    */
-  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2) {
-    auto data_size = data1.size() + data2.size();
-    auto pad = data_size % slice_size != 0;
-    auto elements = data_size / slice_size + (pad ? 1 : 0);
-
-    std::vector<uint8_t> result;
-    result.resize(elements * insert_size + data_size);
-
-    auto next = std::begin(data1);
-    auto end = std::end(data1);
-    for (auto x = 0; x < elements; ++x) {
-      void *p = &result[x * (insert_size + slice_size)];
-
-      // For the last iteration, only copy to the end of the data
-      if (x == elements - 1) {
-        slice_size = data_size - (x * slice_size);
-      }
+  std::string_view gather_and_insert(uint64_t insert_size, uint64_t slice_size, std::span<const std::string_view> data, std::vector<uint8_t> &result) {
+    auto data_size = std::accumulate(std::begin(data), std::end(data), (uint64_t) 0, [](uint64_t size, const std::string_view &buffer) {
+      return size + buffer.size();
+    });
+    auto elements = (data_size + slice_size - 1) / slice_size;
 
-      // Test if this slice will extend into the next buffer
-      if (next + slice_size > end) {
-        // Copy the first portion from the first buffer
-        auto copy_len = end - next;
-        std::copy(next, end, (char *) p + insert_size);
-
-        // Copy the remaining portion from the second buffer
-        next = std::begin(data2);
-        end = std::end(data2);
-        std::copy(next, next + (slice_size - copy_len), (char *) p + copy_len + insert_size);
-        next += slice_size - copy_len;
-      } else {
-        std::copy(next, next + slice_size, (char *) p + insert_size);
-        next += slice_size;
+    auto result_size = elements * insert_size + data_size;
+    if (result.size() < result_size) {
+      result.resize(result_size);
+    }
+
+    auto buffer = std::begin(data);
+    uint64_t buffer_offset = 0;
+    for (uint64_t x = 0; x < elements; ++x) {
+      auto p = result.data() + x * (insert_size + slice_size);
+
+      // The buffer is reused, so clear what may be left of a previous header
+      std::memset(p, 0, insert_size);
+      p += insert_size;
+
+      // For the last slice, only copy to the end of the data
+      auto remaining = std::min(slice_size, data_size - x * slice_size);
+      while (remaining > 0) {
+        auto copy_len = std::min(remaining, buffer->size() - buffer_offset);
+        std::memcpy(p, buffer->data() + buffer_offset, copy_len);
+
+        p += copy_len;
+        remaining -= copy_len;
+        buffer_offset += copy_len;
+
+        // Continue with the next buffer once this one is exhausted
+        if (buffer_offset == buffer->size()) {
+          ++buffer;
+          buffer_offset = 0;
+        }
       }
     }
 
-    return result;
+    return {(char *) result.data(), (size_t) result_size};
   }
 
-  std::vector<uint8_t> replace(const std::string_view &original, const std::string_view &old, const std::string_view &_new) {
-    std::vector<uint8_t> replaced;
-    replaced.reserve(original.size() + _new.size() - old.size());
+  /**
+   * @brief Split a payload around the parts to replace.
+   * @details Each replacement applies to its old data at the offset of the replacement. The payload is
+   *          only searched if the old data isn't found there, then the first occurrence is replaced.
+   * @param payload The payload.
+   * @param replacements The replacements to apply.
+   * @param pieces Receives the pieces of the resulting payload, in order.
+   * @return The size of the resulting payload.
+   */
+  std::size_t splice_replacements(const std::string_view &payload, const std::vector<video::packet_raw_t::replace_t> &replacements, std::vector<std::string_view> &pieces) {
+    std::vector<std::pair<std::size_t, const video::packet_raw_t::replace_t *>> matches;
+    for (auto &replacement : replacements) {
+      auto offset = replacement.offset;
+      if (payload.substr(std::min(offset, payload.size()), replacement.old.size()) != replacement.old) {
+        offset = payload.find(replacement.old);
+        if (offset == std::string_view::npos) {
+          continue;
+        }
+      }
 
-    auto begin = std::begin(original);
-    auto end = std::end(original);
-    auto next = std::search(begin, end, std::begin(old), std::end(old));
+      matches.emplace_back(offset, &replacement);
+    }
+    std::sort(std::begin(matches), std::end(matches));
 
-    std::copy(begin, next, std::back_inserter(replaced));
-    if (next != end) {
-      std::copy(std::begin(_new), std::end(_new), std::back_inserter(replaced));
-      std::copy(next + old.size(), end, std::back_inserter(replaced));
+    std::size_t next = 0;
+    std::size_t size = 0;
+    for (auto &[offset, replacement] : matches) {
+      // Never replace the same data twice
+      if (offset < next) {
+        continue;
+      }
+
+      pieces.emplace_back(payload.substr(next, offset - next));
+      pieces.emplace_back(replacement->_new);
+      size += (offset - next) + replacement->_new.size();
+      next = offset + replacement->old.size();
     }
+    pieces.emplace_back(payload.substr(next));
+    size += payload.size() - next;
 
-    return replaced;
+    return size;
   }
 
   /**
@@ -896,7 +1021,7 @@ namespace stream {
 
   void controlBroadcastThread(control_server_t *server) {
     server->map(packetTypes[IDX_PERIODIC_PING], [](session_t *session, const std::string_view &payload) {
-      BOOST_LOG(verbose) << "type [IDX_PERIODIC_PING]"sv;
+      SUNSHINE_LOG(verbose) << "type [IDX_PERIODIC_PING]"sv;
     });
 
     server->map(packetTypes[IDX_START_A], [&](session_t *session, const std::string_view &payload) {
@@ -1020,7 +1145,7 @@ namespace stream {
     });
 
     server->map(packetTypes[IDX_ENCRYPTED], [server](session_t *session, const std::string_view &payload) {
-      BOOST_LOG(verbose) << "type [IDX_ENCRYPTED]"sv;
+      SUNSHINE_LOG(verbose) << "type [IDX_ENCRYPTED]"sv;
 
       auto header = (control_encrypted_p) (payload.data() - 2);
 
@@ -1093,14 +1218,26 @@ namespace stream {
     // termination when we shut down.
     auto shutdown_event = mail::man->event<bool>(mail::shutdown);
     auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+
+    // Ping timeouts and process liveness are checked at a fixed rate rather than after every batch
+    // of input events, because checking whether the app is running reaps child processes.
+    constexpr auto housekeeping_interval = 100ms;
+    constexpr auto stats_interval = 10s;
+
+    auto next_housekeeping = std::chrono::steady_clock::now();
+    auto last_stats = next_housekeeping;
+    std::uint64_t last_events_processed = 0;
+    std::chrono::steady_clock::duration last_event_time {};
+
     while (!shutdown_event->peek() && !broadcast_shutdown_event->peek()) {
       bool has_session_awaiting_peer = false;
 
+      auto now = std::chrono::steady_clock::now();
+      bool housekeeping = now >= next_housekeeping;
+
       {
         auto lg = server->_sessions.lock();
 
-        auto now = std::chrono::steady_clock::now();
-
         KITTY_WHILE_LOOP(auto pos = std::begin(*server->_sessions), pos != std::end(*server->_sessions), {
           // Don't perform additional session processing if we're shutting down
           if (shutdown_event->peek() || broadcast_shutdown_event->peek()) {
@@ -1109,7 +1246,7 @@ namespace stream {
 
           auto session = *pos;
 
-          if (now > session->pingTimeout) {
+          if (housekeeping && now > session->pingTimeout) {
             auto address = session->control.peer ? platf::from_sockaddr((sockaddr *) &session->control.peer->address.address) : session->control.expected_peer_address;
             BOOST_LOG(info) << address << ": Ping Timeout"sv;
             session::stop(*session);
@@ -1156,13 +1293,30 @@ namespace stream {
         })
       }
 
-      // Don't break until any pending sessions either expire or connect
-      if (proc::proc.running() == 0 && !has_session_awaiting_peer) {
-        BOOST_LOG(info) << "Process terminated"sv;
-        break;
+      if (housekeeping) {
+        // Don't break until any pending sessions either expire or connect
+        if (proc::proc.running() == 0 && !has_session_awaiting_peer) {
+          BOOST_LOG(info) << "Process terminated"sv;
+          break;
+        }
+
+        if (now - last_stats >= stats_interval) {
+          auto events = server->events_processed - last_events_processed;
+          if (events) {
+            auto seconds = std::chrono::duration<double>(now - last_stats).count();
+            auto event_time = std::chrono::duration<double, std::micro>(server->event_time - last_event_time).count();
+            BOOST_LOG(debug) << "Control stream: "sv << events / seconds << " events/s, "sv << event_time / events << "us per event"sv;
+          }
+
+          last_stats = now;
+          last_events_processed = server->events_processed;
+          last_event_time = server->event_time;
+        }
+
+        next_housekeeping = now + housekeeping_interval;
       }
 
-      server->iterate(150ms);
+      server->iterate(std::max(std::chrono::ceil<std::chrono::milliseconds>(next_housekeeping - std::chrono::steady_clock::now()), 0ms));
     }
 
     // Let all remaining connections know the server is shutting down
@@ -1246,7 +1400,7 @@ namespace stream {
         });
 
         auto type_str = buf_elem ? "AUDIO"sv : "VIDEO"sv;
-        BOOST_LOG(verbose) << "Recv: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
+        SUNSHINE_LOG(verbose) << "Recv: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
 
         populate_peer_to_session();
 
@@ -1315,6 +1469,10 @@ namespace stream {
 
     auto ratecontrol_next_frame_start = std::chrono::steady_clock::now();
 
+    // Frames are packetized into this buffer, it grows to fit the largest frame and is then reused
+    std::vector<uint8_t> frame_buffer;
+    std::vector<std::string_view> frame_data;
+
     while (auto packet = packets->pop()) {
       if (shutdown_event->peek()) {
         break;
@@ -1326,28 +1484,29 @@ namespace stream {
       auto lowseq = session->video.lowseq;
 
       std::string_view payload {(char *) packet->data(), packet->data_size()};
-      std::vector<uint8_t> payload_with_replacements;
+
+      // The frame header goes first, followed by the payload
+      video_short_frame_header_t frame_header = {};
+      frame_data.clear();
+      frame_data.emplace_back((char *) &frame_header, sizeof(frame_header));
 
       // Apply replacements on the packet payload before performing any other operations.
       // We need to know the final frame size to calculate the last packet size, and we
       // must avoid matching replacements against the frame header or any other non-video
-      // part of the payload.
+      // part of the payload. The replacements are spliced in while packetizing the frame,
+      // so the payload isn't copied for them.
+      auto payload_size = payload.size();
       if (packet->is_idr() && packet->replacements) {
-        for (auto &replacement : *packet->replacements) {
-          auto frame_old = replacement.old;
-          auto frame_new = replacement._new;
-
-          payload_with_replacements = replace(payload, frame_old, frame_new);
-          payload = {(char *) payload_with_replacements.data(), payload_with_replacements.size()};
-        }
+        payload_size = splice_replacements(payload, *packet->replacements, frame_data);
+      } else {
+        frame_data.emplace_back(payload);
       }
 
-      video_short_frame_header_t frame_header = {};
       frame_header.headerType = 0x01;  // Short header type
       frame_header.frameType = packet->is_idr()                     ? 2 :
                                packet->after_ref_frame_invalidation ? 5 :
                                                                       1;
-      frame_header.lastPayloadLen = (payload.size() + sizeof(frame_header)) % (session->config.packetsize - sizeof(NV_VIDEO_PACKET));
+      frame_header.lastPayloadLen = (payload_size + sizeof(frame_header)) % (session->config.packetsize - sizeof(NV_VIDEO_PACKET));
       if (frame_header.lastPayloadLen == 0) {
         frame_header.lastPayloadLen = session->config.packetsize - sizeof(NV_VIDEO_PACKET);
       }
@@ -1370,9 +1529,7 @@ namespace stream {
       // Insert space for packet headers
       auto blocksize = session->config.packetsize + MAX_RTP_HEADER_SIZE;
       auto payload_blocksize = blocksize - sizeof(video_packet_raw_t);
-      auto payload_new = concat_and_insert(sizeof(video_packet_raw_t), payload_blocksize, std::string_view {(char *) &frame_header, sizeof(frame_header)}, payload);
-
-      payload = std::string_view {(char *) payload_new.data(), payload_new.size()};
+      payload = gather_and_insert(sizeof(video_packet_raw_t), payload_blocksize, frame_data, frame_buffer);
 
       // There are 2 bits for FEC block count for a maximum of 4 FEC blocks
       constexpr auto MAX_FEC_BLOCKS = 4;
@@ -1403,7 +1560,7 @@ namespace stream {
         fec_blocks_begin = std::begin(fec_blocks),
         fec_blocks_end = std::begin(fec_blocks) + fec_blocks_needed;
 
-      BOOST_LOG(verbose) << "Generating "sv << fec_blocks_needed << " FEC blocks"sv;
+      SUNSHINE_LOG(verbose) << "Generating "sv << fec_blocks_needed << " FEC blocks"sv;
 
       // Align individual FEC blocks to blocksize
       auto unaligned_size = payload.size() / fec_blocks_needed;
@@ -1590,9 +1747,9 @@ namespace stream {
           frame_network_latency_logger.second_point_now_and_log();
 
           if (packet->is_idr()) {
-            BOOST_LOG(verbose) << "Key Frame ["sv << packet->frame_index() << "] :: send ["sv << shards.size() << "] shards..."sv;
+            SUNSHINE_LOG(verbose) << "Key Frame ["sv << packet->frame_index() << "] :: send ["sv << shards.size() << "] shards..."sv;
           } else {
-            BOOST_LOG(verbose) << "Frame ["sv << packet->frame_index() << "] :: send ["sv << shards.size() << "] shards..."sv << std::endl;
+            SUNSHINE_LOG(verbose) << "Frame ["sv << packet->frame_index() << "] :: send ["sv << shards.size() << "] shards..."sv << std::endl;
           }
 
           ++blockIndex;
@@ -1653,6 +1810,9 @@ namespace stream {
         break;
       }
 
+      // The packet lives on in its shard, the encoder can reuse the buffer
+      audio::packet_pool().give(std::move(packet_data));
+
       audio_packet.rtp.sequenceNumber = util::endian::big(sequenceNumber);
       audio_packet.rtp.timestamp = util::endian::big(timestamp);
 
@@ -1672,7 +1832,7 @@ namespace stream {
           session->localAddress,
         };
         platf::send(send_info);
-        BOOST_LOG(verbose) << "Audio ["sv << sequenceNumber << "] ::  send..."sv;
+        SUNSHINE_LOG(verbose) << "Audio ["sv << sequenceNumber << "] ::  send..."sv;
 
         auto &fec_packet = session->audio.fec_packet;
         // initialize the FEC header at the beginning of the FEC block
@@ -1700,7 +1860,7 @@ namespace stream {
               session->localAddress,
             };
             platf::send(send_info);
-            BOOST_LOG(verbose) << "Audio FEC ["sv << (sequenceNumber & ~(RTPA_DATA_SHARDS - 1)) << ' ' << x << "] ::  send..."sv;
+            SUNSHINE_LOG(verbose) << "Audio FEC ["sv << (sequenceNumber & ~(RTPA_DATA_SHARDS - 1)) << ' ' << x << "] ::  send..."sv;
           }
         }
       } catch (const std::exception &e) {
@@ -2003,6 +2163,9 @@ namespace stream {
       session.audioThread.join();
       BOOST_LOG(debug) << "Waiting for control to end..."sv;
       session.controlEnd.view();
+      // The queues may outlive the broadcast they wake up
+      session.control.feedback_queue->on_raise(nullptr);
+      session.control.hdr_queue->on_raise(nullptr);
       // Reset input on session stop to avoid stuck repeated keys
       BOOST_LOG(debug) << "Resetting Input..."sv;
       input::reset(session.input);
@@ -2065,6 +2228,13 @@ namespace stream {
         session.broadcast_ref->control_server._sessions->push_back(&session);
       }
 
+      // Rumble, LED and HDR updates go out as soon as they are raised
+      auto wake_control = [server = &session.broadcast_ref->control_server]() {
+        server->wake();
+      };
+      session.control.feedback_queue->on_raise(wake_control);
+      session.control.hdr_queue->on_raise(wake_control);
+
       auto addr = boost::asio::ip::make_address(addr_string);
       session.video.peer.address(addr);
       session.video.peer.port(0);
@@ -36,6 +36,20 @@ namespace safe {
       }
 
       _cv.notify_all();
+
+      if (_on_raise) {
+        _on_raise();
+      }
+    }
+
+    /**
+     * @brief Set a callback that runs each time a value is raised.
+     * @param callback Runs with the lock held, so it must not use this object. `nullptr` removes it.
+     */
+    void on_raise(std::function<void()> callback) {
+      std::lock_guard lg {_lock};
+
+      _on_raise = std::move(callback);
     }
 
     // pop and view should not be used interchangeably
@@ -146,6 +160,8 @@ namespace safe {
 
     std::condition_variable _cv;
     std::mutex _lock;
+
+    std::function<void()> _on_raise;
   };
 
   template<class T>
@@ -273,6 +289,20 @@ namespace safe {
       _queue.emplace_back(std::forward<Args>(args)...);
 
       _cv.notify_all();
+
+      if (_on_raise) {
+        _on_raise();
+      }
+    }
+
+    /**
+     * @brief Set a callback that runs each time a value is raised.
+     * @param callback Runs with the lock held, so it must not use this object. `nullptr` removes it.
+     */
+    void on_raise(std::function<void()> callback) {
+      std::lock_guard lg {_lock};
+
+      _on_raise = std::move(callback);
     }
 
     bool peek() {
@@ -344,6 +374,8 @@ namespace safe {
     std::condition_variable _cv;
 
     std::vector<T> _queue;
+
+    std::function<void()> _on_raise;
   };
 
   template<class T>
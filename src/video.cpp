@@ -4,14 +4,22 @@
  */
 // standard includes
 #include <atomic>
+#include <bit>
 #include <bitset>
+#include <cstring>
+#include <future>
 #include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <thread>
 
 // lib includes
 #include <boost/pointer_cast.hpp>
 
 extern "C" {
+#include <libavutil/avutil.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/mastering_display_metadata.h>
 #include <libavutil/opt.h>
@@ -22,13 +30,18 @@ extern "C" {
 #include "process.h"
 #include "cbs.h"
 #include "config.h"
+#include "crypto.h"
 #include "display_device.h"
+#include "encoder_cache.h"
+#include "file_handler.h"
 #include "globals.h"
 #include "input.h"
 #include "logging.h"
 #include "nvenc/nvenc_base.h"
 #include "platform/common.h"
 #include "sync.h"
+#include "utility.h"
+#include "version.h"
 #include "video.h"
 
 #ifdef _WIN32
@@ -127,12 +140,22 @@ namespace video {
   class avcodec_software_encode_device_t: public platf::avcodec_encode_device_t {
   public:
     int convert(platf::img_t &img) override {
-      // If we need to add aspect ratio padding, we need to scale into an intermediate output buffer
+      // If we need to add aspect ratio padding, sws_output_frame refers to the area of the final frame within the padding
       bool requires_padding = (sw_frame->width != sws_output_frame->width || sw_frame->height != sws_output_frame->height);
 
-      // Setup the input frame using the caller's img_t
+      // Setup the input frame using the caller's img_t.
+      // swscale duplicates frames that aren't reference counted before converting them,
+      // so wrap the image in a buffer reference that doesn't take ownership of it.
       sws_input_frame->data[0] = img.data;
       sws_input_frame->linesize[0] = img.row_pitch;
+      sws_input_frame->buf[0] = av_buffer_create(img.data, (std::size_t) img.row_pitch * img.height, [](void *, uint8_t *) {}, nullptr, AV_BUFFER_FLAG_READONLY);
+      if (!sws_input_frame->buf[0]) {
+        BOOST_LOG(error) << "Couldn't reference image for scaling"sv;
+        return -1;
+      }
+      auto unref_input = util::fail_guard([this]() {
+        av_buffer_unref(&sws_input_frame->buf[0]);
+      });
 
       // Perform color conversion and scaling to the final size
       auto status = sws_scale_frame(sws.get(), requires_padding ? sws_output_frame.get() : sw_frame.get(), sws_input_frame.get());
@@ -142,22 +165,6 @@ namespace video {
         return -1;
       }
 
-      // If we require aspect ratio padding, copy the output frame into the final padded frame
-      if (requires_padding) {
-        auto fmt_desc = av_pix_fmt_desc_get((AVPixelFormat) sws_output_frame->format);
-        auto planes = av_pix_fmt_count_planes((AVPixelFormat) sws_output_frame->format);
-        for (int plane = 0; plane < planes; plane++) {
-          auto shift_h = plane == 0 ? 0 : fmt_desc->log2_chroma_h;
-          auto shift_w = plane == 0 ? 0 : fmt_desc->log2_chroma_w;
-          auto offset = ((offsetW >> shift_w) * fmt_desc->comp[plane].step) + (offsetH >> shift_h) * sw_frame->linesize[plane];
-
-          // Copy line-by-line to preserve leading padding for each row
-          for (int line = 0; line < sws_output_frame->height >> shift_h; line++) {
-            memcpy(sw_frame->data[plane] + offset + (line * sw_frame->linesize[plane]), sws_output_frame->data[plane] + (line * sws_output_frame->linesize[plane]), (size_t) (sws_output_frame->width >> shift_w) * fmt_desc->comp[plane].step);
-          }
-        }
-      }
-
       // If frame is not a software frame, it means we still need to transfer from main memory
       // to vram memory
       if (frame->hw_frames_ctx) {
@@ -242,6 +249,28 @@ namespace video {
       offsetW = (frame->width - out_width) / 2;
       offsetH = (frame->height - out_height) / 2;
 
+      // With aspect ratio padding, scale straight into the destination frame at the offset of the image.
+      // Sharing the buffer of the destination frame keeps swscale from allocating one of its own.
+      auto dst_frame = sw_frame ? sw_frame.get() : this->frame;
+      if (dst_frame->width != out_width || dst_frame->height != out_height) {
+        sws_output_frame->buf[0] = av_buffer_ref(dst_frame->buf[0]);
+        if (!sws_output_frame->buf[0]) {
+          return -1;
+        }
+
+        auto fmt_desc = av_pix_fmt_desc_get(format);
+        auto planes = av_pix_fmt_count_planes(format);
+        for (int plane = 0; plane < planes; plane++) {
+          auto shift_h = plane == 0 ? 0 : fmt_desc->log2_chroma_h;
+          auto shift_w = plane == 0 ? 0 : fmt_desc->log2_chroma_w;
+          auto offset = ((offsetW >> shift_w) * fmt_desc->comp[plane].step) + (offsetH >> shift_h) * dst_frame->linesize[plane];
+
+          // Keep the stride of the destination frame to preserve the padding of each row
+          sws_output_frame->data[plane] = dst_frame->data[plane] + offset;
+          sws_output_frame->linesize[plane] = dst_frame->linesize[plane];
+        }
+      }
+
       sws.reset(sws_alloc_context());
       if (!sws) {
         return -1;
@@ -303,6 +332,12 @@ namespace video {
     ASYNC_TEARDOWN = 1 << 11,  ///< Encoder supports async teardown on a different thread
   };
 
+  class avcodec_encode_session_t;
+  class nvenc_encode_session_t;
+
+  int encode_avcodec(int64_t frame_nr, avcodec_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp);
+  int encode_nvenc(int64_t frame_nr, nvenc_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp);
+
   class avcodec_encode_session_t: public encode_session_t {
   public:
     avcodec_encode_session_t() = default;
@@ -328,6 +363,7 @@ namespace video {
       replacements = std::move(other.replacements);
       sps = std::move(other.sps);
       vps = std::move(other.vps);
+      packet_pool = std::move(other.packet_pool);
 
       inject = other.inject;
 
@@ -362,10 +398,15 @@ namespace video {
       request_idr_frame();
     }
 
+    int encode(int64_t frame_nr, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) override {
+      return encode_avcodec(frame_nr, *this, packets, channel_data, frame_timestamp);
+    }
+
     avcodec_ctx_t avcodec_ctx;
     std::unique_ptr<platf::avcodec_encode_device_t> device;
 
     std::vector<packet_raw_t::replace_t> replacements;
+    std::shared_ptr<packet_pool_t<packet_raw_avcodec>> packet_pool = std::make_shared<packet_pool_t<packet_raw_avcodec>>();
 
     cbs::nal_t sps;
     cbs::nal_t vps;
@@ -405,16 +446,22 @@ namespace video {
       }
     }
 
-    nvenc::nvenc_encoded_frame encode_frame(uint64_t frame_index) {
+    int encode(int64_t frame_nr, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) override {
+      return encode_nvenc(frame_nr, *this, packets, channel_data, frame_timestamp);
+    }
+
+    nvenc::nvenc_encoded_frame encode_frame(uint64_t frame_index, std::vector<uint8_t> &&buffer) {
       if (!device || !device->nvenc) {
         return {};
       }
 
-      auto result = device->nvenc->encode_frame(frame_index, force_idr);
+      auto result = device->nvenc->encode_frame(frame_index, force_idr, std::move(buffer));
       force_idr = false;
       return result;
     }
 
+    std::shared_ptr<packet_pool_t<packet_raw_generic>> packet_pool = std::make_shared<packet_pool_t<packet_raw_generic>>();
+
   private:
     std::unique_ptr<platf::nvenc_encode_device_t> device;
     bool force_idr = false;
@@ -451,6 +498,8 @@ namespace video {
     std::thread capture_thread;
 
     safe::signal_t reinit_event;
+    safe::signal_t display_released;  ///< Raised by encoders once they dropped their references to the display being reinitialized
+    safe::signal_t display_ready;  ///< Raised once the reinitialized display is available
     const encoder_t *encoder_p;
     sync_util::sync_t<std::weak_ptr<platf::display_t>> display_wp;
   };
@@ -1028,6 +1077,28 @@ namespace video {
     true,
     true
   };
+  std::atomic<uint32_t> encoder_probe_generation {0};
+
+  static encoder_cache::cache_t capability_cache;
+  static std::atomic_bool capability_cache_used {false};  ///< The chosen encoder was selected based on cached capabilities that weren't confirmed yet
+  static std::atomic_bool capability_cache_stale {false};  ///< Confirming the cached capabilities found them out of date
+  static std::atomic_int active_streams {0};
+  static std::recursive_mutex probe_lock;  ///< Held while probing encoders or confirming cached capabilities
+  static std::atomic_bool capability_confirmation_cancel {false};
+
+  /**
+   * @brief Cancel the background confirmation of cached capabilities and wait for it to put the encoder back.
+   * @return The probe lock, which keeps another confirmation from starting while it's held.
+   */
+  std::unique_lock<std::recursive_mutex> interrupt_capability_confirmation() {
+    capability_confirmation_cancel = true;
+    std::unique_lock ul {probe_lock};
+    capability_confirmation_cancel = false;
+
+    return ul;
+  }
+
+  void confirm_cached_capabilities();
 
   void reset_display(std::shared_ptr<platf::display_t> &disp, const platf::mem_type_e &type, const std::string &display_name, const config_t &config) {
     // We try this twice, in case we still get an error on reinitialization
@@ -1106,10 +1177,162 @@ namespace video {
     refresh_displays(dev_type, display_names, current_display_index, empty_str);
   }
 
+  std::unique_ptr<platf::encode_device_t> make_encode_device(platf::display_t &disp, const encoder_t &encoder, const config_t &config);
+  std::unique_ptr<encode_session_t> make_encode_session(platf::display_t *disp, const encoder_t &encoder, const config_t &config, int width, int height, std::unique_ptr<platf::encode_device_t> encode_device);
+
+  /**
+   * @brief An idle encode session, prepared after a stream ended for a client coming back with the same configuration.
+   * @details The display it was created for is kept alive along with it, so the next capture thread can adopt it.
+   */
+  struct warm_session_t {
+    const encoder_t *encoder;
+    config_t config;
+    std::string display_name;
+    std::shared_ptr<platf::display_t> display;
+    std::unique_ptr<encode_session_t> session;
+    sunshine_colorspace_t colorspace;
+    std::chrono::steady_clock::time_point expiry;
+  };
+
+  static std::mutex warm_session_lock;
+  static std::optional<warm_session_t> warm_session;
+  static std::atomic_int active_async_captures {0};
+
+  bool same_config(const config_t &a, const config_t &b) {
+    return a.width == b.width &&
+           a.height == b.height &&
+           a.framerate == b.framerate &&
+           a.bitrate == b.bitrate &&
+           a.slicesPerFrame == b.slicesPerFrame &&
+           a.numRefFrames == b.numRefFrames &&
+           a.encoderCscMode == b.encoderCscMode &&
+           a.videoFormat == b.videoFormat &&
+           a.dynamicRange == b.dynamicRange &&
+           a.chromaSamplingType == b.chromaSamplingType &&
+           a.enableIntraRefresh == b.enableIntraRefresh &&
+           a.encodingFramerate == b.encodingFramerate &&
+           a.input_only == b.input_only;
+  }
+
+  void retire_warm_session() {
+    std::optional<warm_session_t> retired;
+    {
+      std::lock_guard lg {warm_session_lock};
+      retired.swap(warm_session);
+    }
+
+    if (retired) {
+      BOOST_LOG(info) << "Retiring warm encode session"sv;
+    }
+  }
+
+  void retire_expired_warm_session() {
+    std::optional<warm_session_t> retired;
+    {
+      std::lock_guard lg {warm_session_lock};
+      if (warm_session && warm_session->expiry <= std::chrono::steady_clock::now()) {
+        retired.swap(warm_session);
+      }
+    }
+
+    if (retired) {
+      BOOST_LOG(info) << "Retiring idle warm encode session"sv;
+    }
+  }
+
+  /**
+   * @brief Prepare a new encode session on the display of a stream that just ended.
+   * @param display The display the stream was captured from.
+   * @param encoder The encoder the stream used.
+   * @param config The configuration of the stream.
+   */
+  void park_warm_session(std::shared_ptr<platf::display_t> display, const encoder_t &encoder, const config_t &config) {
+    if (config::video.warm_session_timeout <= 0ms || config.input_only) {
+      return;
+    }
+
+    std::optional<warm_session_t> retired;
+    std::lock_guard lg {warm_session_lock};
+
+    // The session is created under the lock, so a new stream doesn't set up its own in parallel on the same display
+    auto encode_device = make_encode_device(*display, encoder, config);
+    if (!encode_device) {
+      return;
+    }
+
+    auto colorspace = encode_device->colorspace;
+    auto session = make_encode_session(display.get(), encoder, config, display->width, display->height, std::move(encode_device));
+    if (!session) {
+      return;
+    }
+
+    retired.swap(warm_session);
+    warm_session = warm_session_t {
+      &encoder,
+      config,
+      proc::proc.display_name,
+      std::move(display),
+      std::move(session),
+      colorspace,
+      std::chrono::steady_clock::now() + config::video.warm_session_timeout,
+    };
+    task_pool.pushDelayed(&retire_expired_warm_session, config::video.warm_session_timeout);
+
+    BOOST_LOG(info) << "Keeping a warm encode session for "sv << config.width << 'x' << config.height << 'x' << config.framerate
+                    << " on encoder ["sv << encoder.name << ']';
+  }
+
+  /**
+   * @brief Get the display of the warm session if the new capture matches it.
+   * @details A warm session that doesn't match is retired, so its display is released before another one is created.
+   * @return The display of the warm session, or `nullptr`.
+   */
+  std::shared_ptr<platf::display_t> adopt_warm_display(const encoder_t &encoder, const std::string &display_name, const config_t &config) {
+    std::optional<warm_session_t> retired;
+    std::lock_guard lg {warm_session_lock};
+    if (!warm_session) {
+      return nullptr;
+    }
+
+    if (warm_session->encoder == &encoder && warm_session->display_name == display_name && same_config(warm_session->config, config)) {
+      return warm_session->display;
+    }
+
+    retired.swap(warm_session);
+    return nullptr;
+  }
+
+  /**
+   * @brief Take the warm session if it was prepared for this display and configuration.
+   * @param display The display captured from.
+   * @param encoder The encoder to use.
+   * @param config The configuration of the stream.
+   * @param colorspace Set to the colorspace of the session on success.
+   * @return The warm session, or `nullptr`.
+   */
+  std::unique_ptr<encode_session_t> take_warm_session(const platf::display_t *display, const encoder_t &encoder, const config_t &config, sunshine_colorspace_t &colorspace) {
+    std::optional<warm_session_t> taken;
+    std::lock_guard lg {warm_session_lock};
+    if (!warm_session || warm_session->display.get() != display) {
+      return nullptr;
+    }
+
+    taken.swap(warm_session);
+    if (taken->encoder != &encoder || !same_config(taken->config, config)) {
+      return nullptr;
+    }
+
+    BOOST_LOG(info) << "Using warm encode session"sv;
+    colorspace = taken->colorspace;
+    return std::move(taken->session);
+  }
+
   void captureThread(
     std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_queue,
     sync_util::sync_t<std::weak_ptr<platf::display_t>> &display_wp,
     safe::signal_t &reinit_event,
+    safe::signal_t &display_released,
+    safe::signal_t &display_ready,
     const encoder_t &encoder
   ) {
     std::vector<capture_ctx_t> capture_ctxs;
@@ -1135,17 +1358,26 @@ namespace video {
     }
     capture_ctxs.emplace_back(std::move(*initial_capture_ctx));
 
+    auto open_display = [&](const std::string &display_name) {
+      // Reuse the display of a warm encode session prepared for this capture
+      if (auto disp = adopt_warm_display(encoder, display_name, capture_ctxs.front().config)) {
+        return disp;
+      }
+
+      return platf::display(encoder.platform_formats->dev_type, display_name, capture_ctxs.front().config);
+    };
+
     std::vector<std::string> display_names;
     int display_p = -1;
     std::shared_ptr<platf::display_t> disp;
     if (!proc::proc.display_name.empty()) {
-      disp = platf::display(encoder.platform_formats->dev_type, proc::proc.display_name, capture_ctxs.front().config);
+      disp = open_display(proc::proc.display_name);
     }
     if (!disp) {
       // Get all the monitor names now, rather than at boot, to
       // get the most up-to-date list available monitors
       refresh_displays(encoder.platform_formats->dev_type, display_names, display_p);
-      disp = platf::display(encoder.platform_formats->dev_type, display_names[display_p], capture_ctxs.front().config);
+      disp = open_display(display_names[display_p]);
       if (disp) {
         proc::proc.display_name = display_names[display_p];
       } else {
@@ -1255,10 +1487,25 @@ namespace video {
     // Capture takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::critical);
 
+    // Images in system memory are recaptured on every interval, whether or not anything changed
+    std::optional<frame_change_detector_t> change_detector;
+    if (encoder.platform_formats->dev_type == platf::mem_type_e::system) {
+      change_detector.emplace();
+    }
+
     while (capture_ctx_queue->running()) {
       bool artificial_reinit = false;
 
+      if (change_detector) {
+        change_detector->reset();
+      }
+
       auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
+        // Unchanged frames aren't converted or encoded, encoders repeat the last frame at the minimum framerate
+        if (frame_captured && change_detector && !change_detector->changed(*img)) {
+          frame_captured = false;
+        }
+
         KITTY_WHILE_LOOP(auto capture_ctx = std::begin(capture_ctxs), capture_ctx != std::end(capture_ctxs), {
           if (!capture_ctx->images->running()) {
             capture_ctx = capture_ctxs.erase(capture_ctx);
@@ -1279,6 +1526,11 @@ namespace video {
 
         while (capture_ctx_queue->peek()) {
           capture_ctxs.emplace_back(std::move(*capture_ctx_queue->pop()));
+
+          // The new session needs a frame even if the screen stays static
+          if (change_detector) {
+            change_detector->reset();
+          }
         }
 
         if (switch_display_event->peek()) {
@@ -1300,6 +1552,8 @@ namespace video {
       switch (status) {
         case platf::capture_e::reinit:
           {
+            display_ready.reset();
+            display_released.reset();
             reinit_event.raise(true);
 
             // Some classes of images contain references to the display --> display won't delete unless img is deleted
@@ -1328,7 +1582,8 @@ namespace video {
                 ++capture_ctx;
               });
 
-              std::this_thread::sleep_for(20ms);
+              // Encoders signal when they let go of the display, but teardown threads holding on to it don't
+              display_released.pop(20ms);
             }
 
             while (capture_ctx_queue->running()) {
@@ -1358,6 +1613,7 @@ namespace video {
             display_wp = disp;
 
             reinit_event.reset();
+            display_ready.raise(true);
             continue;
           }
         case platf::capture_e::error:
@@ -1391,8 +1647,8 @@ namespace video {
     }
 
     while (ret >= 0) {
-      auto packet = std::make_unique<packet_raw_avcodec>();
-      auto av_packet = packet.get()->av_packet;
+      auto packet = session.packet_pool->acquire();
+      auto av_packet = static_cast<packet_raw_avcodec *>(packet.get())->av_packet;
 
       ret = avcodec_receive_packet(ctx.get(), av_packet);
       if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
@@ -1410,6 +1666,21 @@ namespace video {
       }
 
       if (session.inject) {
+        std::string_view payload {(char *) av_packet->data, (std::size_t) av_packet->size};
+
+        // The encoder emits the parameter sets at the same place in every IDR frame,
+        // remember where so the broadcast thread doesn't have to search for them.
+        auto add_replacement = [&](const cbs::nal_t &nal) {
+          std::string_view old {(char *) std::begin(nal.old), nal.old.size()};
+          auto offset = payload.find(old);
+
+          session.replacements.emplace_back(
+            old,
+            std::string_view((char *) std::begin(nal._new), nal._new.size()),
+            offset == std::string_view::npos ? 0 : offset
+          );
+        };
+
         if (session.inject == 1) {
           auto h264 = cbs::make_sps_h264(ctx.get(), av_packet);
 
@@ -1420,18 +1691,12 @@ namespace video {
           sps = std::move(hevc.sps);
           vps = std::move(hevc.vps);
 
-          session.replacements.emplace_back(
-            std::string_view((char *) std::begin(vps.old), vps.old.size()),
-            std::string_view((char *) std::begin(vps._new), vps._new.size())
-          );
+          add_replacement(vps);
         }
 
         session.inject = 0;
 
-        session.replacements.emplace_back(
-          std::string_view((char *) std::begin(sps.old), sps.old.size()),
-          std::string_view((char *) std::begin(sps._new), sps._new.size())
-        );
+        add_replacement(sps);
       }
 
       if (av_packet && av_packet->pts == frame_nr) {
@@ -1447,7 +1712,11 @@ namespace video {
   }
 
   int encode_nvenc(int64_t frame_nr, nvenc_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
-    auto encoded_frame = session.encode_frame(frame_nr);
+    auto packet = session.packet_pool->acquire();
+    auto packet_generic = static_cast<packet_raw_generic *>(packet.get());
+
+    // Encode into the payload buffer of a recycled packet
+    auto encoded_frame = session.encode_frame(frame_nr, std::move(packet_generic->frame_data));
     if (encoded_frame.data.empty()) {
       BOOST_LOG(error) << "NvENC returned empty packet";
       return -1;
@@ -1457,7 +1726,9 @@ namespace video {
       BOOST_LOG(error) << "NvENC frame index mismatch " << frame_nr << " " << encoded_frame.frame_index;
     }
 
-    auto packet = std::make_unique<packet_raw_generic>(std::move(encoded_frame.data), encoded_frame.frame_index, encoded_frame.idr);
+    packet_generic->frame_data = std::move(encoded_frame.data);
+    packet_generic->index = encoded_frame.frame_index;
+    packet_generic->idr = encoded_frame.idr;
     packet->channel_data = channel_data;
     packet->after_ref_frame_invalidation = encoded_frame.after_ref_frame_invalidation;
     packet->frame_timestamp = frame_timestamp;
@@ -1467,13 +1738,7 @@ namespace video {
   }
 
   int encode(int64_t frame_nr, encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
-    if (auto avcodec_session = dynamic_cast<avcodec_encode_session_t *>(&session)) {
-      return encode_avcodec(frame_nr, *avcodec_session, packets, channel_data, frame_timestamp);
-    } else if (auto nvenc_session = dynamic_cast<nvenc_encode_session_t *>(&session)) {
-      return encode_nvenc(frame_nr, *nvenc_session, packets, channel_data, frame_timestamp);
-    }
-
-    return -1;
+    return session.encode(frame_nr, packets, channel_data, frame_timestamp);
   }
 
   std::unique_ptr<avcodec_encode_session_t> make_avcodec_encode_session(
@@ -1866,22 +2131,139 @@ namespace video {
     return nullptr;
   }
 
+  frame_pacer_t::frame_pacer_t(int framerate):
+      _interval {std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / std::max(framerate, 1)))} {
+  }
+
+  bool frame_pacer_t::accept(time_point timestamp) {
+    // Track the capture cadence, limiting how far a single stall can skew the estimate
+    if (_last_captured && timestamp > *_last_captured) {
+      auto delta = timestamp - *_last_captured;
+      if (_source_interval.count() == 0) {
+        _source_interval = delta;
+      } else {
+        _source_interval = (_source_interval * 7 + std::min(delta, _source_interval * 2)) / 8;
+      }
+    }
+    _last_captured = timestamp;
+
+    // A frame this far ahead of the deadline will be superseded by one closer to it
+    if (_deadline && timestamp < *_deadline - std::min(_source_interval, _interval) / 2) {
+      if (_holding) {
+        ++dropped;
+      }
+      _holding = true;
+
+      return false;
+    }
+
+    if (_holding) {
+      ++dropped;
+      _holding = false;
+    }
+    advance(timestamp);
+
+    return true;
+  }
+
+  void frame_pacer_t::release(time_point timestamp) {
+    _holding = false;
+    advance(timestamp);
+  }
+
+  void frame_pacer_t::advance(time_point timestamp) {
+    if (_last_encoded && timestamp > *_last_encoded) {
+      auto ms = std::chrono::round<std::chrono::milliseconds>(timestamp - *_last_encoded).count();
+      ++_histogram[std::min<std::size_t>(ms, _histogram.size() - 1)];
+    }
+    _last_encoded = timestamp;
+    ++encoded;
+
+    // Stay in phase with the previous deadline, unless capture stalled or content was static for a while
+    if (!_deadline || timestamp - *_deadline > _interval / 2) {
+      _deadline = timestamp + _interval;
+    } else {
+      _deadline = *_deadline + _interval;
+    }
+  }
+
+  std::string frame_pacer_t::interval_histogram() const {
+    std::stringstream ss;
+    for (std::size_t x = 0; x < _histogram.size(); ++x) {
+      if (!_histogram[x]) {
+        continue;
+      }
+
+      if (ss.tellp() > 0) {
+        ss << ", "sv;
+      }
+      ss << x << (x == _histogram.size() - 1 ? "+ms: "sv : "ms: "sv) << _histogram[x];
+    }
+
+    return ss.str();
+  }
+
+  bool frame_change_detector_t::changed(const platf::img_t &img) {
+    // The xxHash64 primes, round and avalanche
+    constexpr std::uint64_t prime_1 = 0x9e3779b185ebca87;
+    constexpr std::uint64_t prime_2 = 0xc2b2ae3d27d4eb4f;
+    constexpr std::uint64_t prime_3 = 0x165667b19e3779f9;
+
+    // The rotation feeds the high bits back into the multiplication, so changes can't cancel out in bit 63
+    auto round = [](std::uint64_t acc, std::uint64_t input) {
+      return std::rotl(acc + input * prime_2, 31) * prime_1;
+    };
+
+    // Independent lanes keep several multiplications in flight at once
+    std::array<std::uint64_t, 4> lanes {prime_1 + prime_2, prime_2, 0, 0 - prime_1};
+
+    const auto row_size = (std::size_t) img.width * img.pixel_pitch;
+    for (int y = 0; y < img.height; ++y) {
+      const auto *row = img.data + (std::size_t) y * img.row_pitch;
+
+      std::size_t x = 0;
+      for (; x + sizeof(std::uint64_t) * lanes.size() <= row_size; x += sizeof(std::uint64_t) * lanes.size()) {
+        for (std::size_t lane = 0; lane < lanes.size(); ++lane) {
+          std::uint64_t word;
+          std::memcpy(&word, row + x + lane * sizeof(word), sizeof(word));
+          lanes[lane] = round(lanes[lane], word);
+        }
+      }
+      for (; x < row_size; ++x) {
+        lanes[0] = round(lanes[0], row[x]);
+      }
+    }
+
+    std::uint64_t hash = ((std::uint64_t) img.width << 32) | (std::uint32_t) img.height;
+    for (auto lane : lanes) {
+      hash = round(hash, lane);
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime_2;
+    hash ^= hash >> 29;
+    hash *= prime_3;
+    hash ^= hash >> 32;
+
+    if (_hash == hash) {
+      return false;
+    }
+
+    _hash = hash;
+    return true;
+  }
+
   void encode_run(
     int &frame_nr,  // Store progress of the frame number
     safe::mail_t mail,
     img_event_t images,
     config_t config,
     std::shared_ptr<platf::display_t> disp,
-    std::unique_ptr<platf::encode_device_t> encode_device,
+    std::unique_ptr<encode_session_t> session,
     safe::signal_t &reinit_event,
     const encoder_t &encoder,
     void *channel_data
   ) {
-    auto session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height, std::move(encode_device));
-    if (!session) {
-      return;
-    }
-
     // As a workaround for NVENC hangs and to generally speed up encoder reinit,
     // we will complete the encoder teardown in a separate thread if supported.
     // This will move expensive processing off the encoder thread to allow us
@@ -1901,13 +2283,7 @@ namespace video {
 
     // set minimum frame time, avoiding violation of client-requested target framerate
     auto minimum_frame_time = std::chrono::milliseconds(1000 / std::min(config.framerate, (config::video.min_fps_factor * 10)));
-    auto frame_threshold = std::chrono::milliseconds(1000 / config.encodingFramerate);
-    // Leave 1ms headroom for slight variations
-    if (frame_threshold >= 2ms) {
-      frame_threshold -= 1ms;
-    }
     BOOST_LOG(debug) << "Minimum frame time set to "sv << minimum_frame_time.count() << "ms, based on min fps factor of "sv << config::video.min_fps_factor << "."sv;
-    BOOST_LOG(info) << "Frame threshold: "sv << frame_threshold;
 
     auto shutdown_event = mail->event<bool>(mail::shutdown);
     auto packets = mail::man->queue<packet_t>(mail::video_packets);
@@ -1939,7 +2315,15 @@ namespace video {
       return;
     }
 
-    std::chrono::steady_clock::time_point last_frame_timestamp;
+    frame_pacer_t pacer {config.encodingFramerate};
+    auto log_pacing = util::fail_guard([&pacer]() {
+      BOOST_LOG(info) << "Frame pacing: encoded "sv << pacer.encoded << ", dropped "sv << pacer.dropped
+                      << ", capture interval "sv << std::chrono::duration<double, std::milli>(pacer.source_interval()).count() << "ms"sv;
+      BOOST_LOG(info) << "Encoded frame intervals: "sv << pacer.interval_histogram();
+    });
+
+    // An early frame waiting to see whether a later one lands closer to the pacing deadline
+    std::shared_ptr<platf::img_t> held_img;
 
     while (true) {
       // Break out of the encoding loop if any of the following are true:
@@ -1974,12 +2358,26 @@ namespace video {
 
       // Encode at a minimum FPS to avoid image quality issues with static content
       if (!requested_idr_frame || images->peek()) {
-        if (auto img = images->pop(minimum_frame_time)) {
+        std::chrono::steady_clock::duration timeout = minimum_frame_time;
+        if (held_img) {
+          timeout = std::max(*pacer.deadline() - std::chrono::steady_clock::now(), std::chrono::steady_clock::duration::zero());
+        }
+
+        auto img = images->pop(timeout);
+        if (img && img->frame_timestamp && !pacer.accept(*img->frame_timestamp)) {
+          held_img = std::move(img);
+          continue;
+        }
+
+        if (!img && held_img) {
+          // Nothing closer to the deadline arrived, so the held frame is the freshest we have
+          pacer.release(*held_img->frame_timestamp);
+          img = std::move(held_img);
+        }
+        held_img.reset();
+
+        if (img) {
           frame_timestamp = img->frame_timestamp;
-          // If new frame comes in way too fast, just drop
-          if (*frame_timestamp - last_frame_timestamp < frame_threshold) {
-            continue;
-          }
           if (session->convert(*img)) {
             BOOST_LOG(error) << "Could not convert image"sv;
             break;
@@ -1994,8 +2392,6 @@ namespace video {
         break;
       }
 
-      last_frame_timestamp = *frame_timestamp;
-
       session->request_normal_frame();
     }
   }
@@ -2329,13 +2725,23 @@ namespace video {
     auto touch_port_event = mail->event<input::touch_port_t>(mail::touch_port);
     auto hdr_event = mail->event<hdr_info_t>(mail::hdr);
 
+    ++active_async_captures;
+    auto active_guard = util::fail_guard([]() {
+      --active_async_captures;
+    });
+    // Weak, so the display can still be released when it's reinitialized
+    std::weak_ptr<platf::display_t> last_display;
+    const encoder_t *last_encoder = nullptr;
+
     // Encoding takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::high);
 
     while (!shutdown_event->peek() && images->running()) {
       // Wait for the main capture event when the display is being reinitialized
       if (ref->reinit_event.peek()) {
-        std::this_thread::sleep_for(20ms);
+        // The previous session is gone by now, so the capture thread doesn't have to wait for us any longer
+        ref->display_released.raise(true);
+        ref->display_ready.view(20ms);
         continue;
       }
       // Wait for the display to be ready
@@ -2351,17 +2757,29 @@ namespace video {
 
       auto &encoder = *chosen_encoder;
 
-      auto encode_device = make_encode_device(*display, encoder, config);
-      if (!encode_device) {
-        return;
+      sunshine_colorspace_t colorspace;
+      auto session = take_warm_session(display.get(), encoder, config, colorspace);
+      if (!session) {
+        auto encode_device = make_encode_device(*display, encoder, config);
+        if (!encode_device) {
+          return;
+        }
+
+        colorspace = encode_device->colorspace;
+        session = make_encode_session(display.get(), encoder, config, display->width, display->height, std::move(encode_device));
+        if (!session) {
+          continue;
+        }
       }
+      last_display = display;
+      last_encoder = &encoder;
 
       // absolute mouse coordinates require that the dimensions of the screen are known
       touch_port_event->raise(make_port(display.get(), config));
 
       // Update client with our current HDR display state
       hdr_info_t hdr_info = std::make_unique<hdr_info_raw_t>(false);
-      if (colorspace_is_hdr(encode_device->colorspace)) {
+      if (colorspace_is_hdr(colorspace)) {
         if (display->get_hdr_metadata(hdr_info->metadata)) {
           hdr_info->enabled = true;
         } else {
@@ -2376,12 +2794,18 @@ namespace video {
         images,
         config,
         display,
-        std::move(encode_device),
+        std::move(session),
         ref->reinit_event,
         *ref->encoder_p,
         channel_data
       );
     }
+
+    // Prepare for the client coming back, unless other streams are still using the display
+    auto display = last_display.lock();
+    if (display && shutdown_event->peek() && active_async_captures == 1) {
+      park_warm_session(std::move(display), *last_encoder, config);
+    }
   }
 
   void capture(
@@ -2389,6 +2813,15 @@ namespace video {
     config_t config,
     void *channel_data
   ) {
+    // The encoder can't be confirmed in the background while the stream uses it
+    ++active_streams;
+    interrupt_capability_confirmation();
+    auto confirm_after_stream = util::fail_guard([]() {
+      if (--active_streams == 0 && capability_cache_used) {
+        task_pool.push(confirm_cached_capabilities);
+      }
+    });
+
     auto idr_events = mail->event<bool>(mail::idr);
 
     idr_events->raise(true);
@@ -2439,7 +2872,8 @@ namespace video {
 
     session->request_idr_frame();
 
-    auto packets = mail::man->queue<packet_t>(mail::video_packets);
+    // Encoders may be validated concurrently, so each probe gets a queue of its own
+    auto packets = std::make_shared<safe::mail_raw_t>()->queue<packet_t>(mail::video_packets);
     while (!packets->peek()) {
       if (encode(1, *session, packets, nullptr, {})) {
         return -1;
@@ -2470,10 +2904,28 @@ namespace video {
     return flag;
   }
 
-  bool validate_encoder(encoder_t &encoder, bool expect_failure) {
+  bool validate_encoder(encoder_t &encoder, bool expect_failure, const std::atomic_bool *cancel) {
     const auto output_name {display_device::map_output_name(config::video.output_name)};
     std::shared_ptr<platf::display_t> disp;
 
+    auto probe = [&](const config_t &config) {
+      // Fail the remaining probes quickly once the result isn't needed anymore
+      if (cancel && *cancel) {
+        return -1;
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      auto result = validate_config(disp, encoder, config);
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+      BOOST_LOG(info) << "Encoder ["sv << encoder.name << "] probe of "sv << encoder.codec_from_config(config).name
+                      << (config.numRefFrames ? " (max ref frames"sv : " (autoselect ref frames"sv)
+                      << (config.dynamicRange ? ", 10-bit"sv : ""sv)
+                      << (config.chromaSamplingType ? ", 4:4:4)"sv : ")"sv)
+                      << (result >= 0 ? " passed in "sv : " failed in "sv) << elapsed.count() << "ms"sv;
+      return result;
+    };
+
     BOOST_LOG(info) << "Trying encoder ["sv << encoder.name << ']';
     auto fg = util::fail_guard([&]() {
       BOOST_LOG(info) << "Encoder ["sv << encoder.name << "] failed"sv;
@@ -2503,13 +2955,13 @@ namespace video {
 
     // If we're expecting failure, use the autoselect ref config first since that will always succeed
     // if the encoder is available.
-    auto max_ref_frames_h264 = expect_failure ? -1 : validate_config(disp, encoder, config_max_ref_frames);
-    auto autoselect_h264 = max_ref_frames_h264 >= 0 ? max_ref_frames_h264 : validate_config(disp, encoder, config_autoselect);
+    auto max_ref_frames_h264 = expect_failure ? -1 : probe(config_max_ref_frames);
+    auto autoselect_h264 = max_ref_frames_h264 >= 0 ? max_ref_frames_h264 : probe(config_autoselect);
     if (autoselect_h264 < 0) {
       return false;
     } else if (expect_failure) {
       // We expected failure, but actually succeeded. Do the max_ref_frames probe we skipped.
-      max_ref_frames_h264 = validate_config(disp, encoder, config_max_ref_frames);
+      max_ref_frames_h264 = probe(config_max_ref_frames);
     }
 
     std::vector<std::pair<validate_flag_e, encoder_t::flag_e>> packet_deficiencies {
@@ -2528,13 +2980,13 @@ namespace video {
       config_autoselect.videoFormat = 1;
 
       if (disp->is_codec_supported(encoder.hevc.name, config_autoselect)) {
-        auto max_ref_frames_hevc = validate_config(disp, encoder, config_max_ref_frames);
+        auto max_ref_frames_hevc = probe(config_max_ref_frames);
 
         // If H.264 succeeded with max ref frames specified, assume that we can count on
         // HEVC to also succeed with max ref frames specified if HEVC is supported.
         auto autoselect_hevc = (max_ref_frames_hevc >= 0 || max_ref_frames_h264 >= 0) ?
                                  max_ref_frames_hevc :
-                                 validate_config(disp, encoder, config_autoselect);
+                                 probe(config_autoselect);
 
         for (auto [validate_flag, encoder_flag] : packet_deficiencies) {
           encoder.hevc[encoder_flag] = (max_ref_frames_hevc & validate_flag && autoselect_hevc & validate_flag);
@@ -2556,13 +3008,13 @@ namespace video {
       config_autoselect.videoFormat = 2;
 
       if (disp->is_codec_supported(encoder.av1.name, config_autoselect)) {
-        auto max_ref_frames_av1 = validate_config(disp, encoder, config_max_ref_frames);
+        auto max_ref_frames_av1 = probe(config_max_ref_frames);
 
         // If H.264 succeeded with max ref frames specified, assume that we can count on
         // AV1 to also succeed with max ref frames specified if AV1 is supported.
         auto autoselect_av1 = (max_ref_frames_av1 >= 0 || max_ref_frames_h264 >= 0) ?
                                 max_ref_frames_av1 :
-                                validate_config(disp, encoder, config_autoselect);
+                                probe(config_autoselect);
 
         for (auto [validate_flag, encoder_flag] : packet_deficiencies) {
           encoder.av1[encoder_flag] = (max_ref_frames_av1 & validate_flag && autoselect_av1 & validate_flag);
@@ -2585,7 +3037,7 @@ namespace video {
       if (encoder.flags & YUV444_SUPPORT) {
         config_t config_h264_yuv444 {1920, 1080, 60, 1000, 1, 0, 1, 0, 0, 1};
         encoder.h264[encoder_t::YUV444] = disp->is_codec_supported(encoder.h264.name, config_h264_yuv444) &&
-                                          validate_config(disp, encoder, config_h264_yuv444) >= 0;
+                                          probe(config_h264_yuv444) >= 0;
       } else {
         encoder.h264[encoder_t::YUV444] = false;
       }
@@ -2612,7 +3064,7 @@ namespace video {
         config.chromaSamplingType = 1;
         if ((encoder.flags & YUV444_SUPPORT) &&
             disp->is_codec_supported(encoder_codec_name, config) &&
-            validate_config(disp, encoder, config) >= 0) {
+            probe(config) >= 0) {
           flag_map[encoder_t::DYNAMIC_RANGE] = true;
           flag_map[encoder_t::YUV444] = true;
           return;
@@ -2623,7 +3075,7 @@ namespace video {
         // Test 4:2:0 HDR
         config.chromaSamplingType = 0;
         if (disp->is_codec_supported(encoder_codec_name, config) &&
-            validate_config(disp, encoder, config) >= 0) {
+            probe(config) >= 0) {
           flag_map[encoder_t::DYNAMIC_RANGE] = true;
         } else {
           flag_map[encoder_t::DYNAMIC_RANGE] = false;
@@ -2651,19 +3103,228 @@ namespace video {
     return true;
   }
 
+  /**
+   * @brief Identify the device an encoder is probed on.
+   * @details Encoders sharing a device are never validated at the same time.
+   */
+  int probe_device(const encoder_t &encoder) {
+#ifdef __linux__
+    return (int) encoder.platform_formats->dev_type;
+#else
+    // Every encoder captures the same outputs through a single API (e.g. DXGI Desktop Duplication),
+    // which doesn't allow capturing an output multiple times at once reliably
+    return 0;
+#endif
+  }
+
+  encoder_prober_t::encoder_prober_t(const std::vector<encoder_t *> &candidates, const encoder_t *previous_encoder) {
+    std::map<int, std::vector<encoder_t *>> devices;
+    for (auto encoder : candidates) {
+      devices[probe_device(*encoder)].emplace_back(encoder);
+      _results.emplace(encoder, _promises[encoder].get_future());
+    }
+
+    for (auto &[_, device_encoders] : devices) {
+      _threads.emplace_back(&encoder_prober_t::run, this, std::move(device_encoders), previous_encoder);
+    }
+  }
+
+  encoder_prober_t::~encoder_prober_t() {
+    stop();
+  }
+
+  bool encoder_prober_t::validate(encoder_t &encoder) {
+    {
+      std::lock_guard lg {_lock};
+      _requested.emplace(&encoder);
+    }
+    _cv.notify_all();
+
+    auto &result = _results.at(&encoder);
+    if (!_passed.contains(&encoder)) {
+      _passed.emplace(&encoder, result.get());
+    }
+
+    return _passed[&encoder];
+  }
+
+  void encoder_prober_t::stop() {
+    {
+      std::lock_guard lg {_lock};
+      _cancel = true;
+    }
+    _cv.notify_all();
+
+    for (auto &thread : _threads) {
+      if (thread.joinable()) {
+        thread.join();
+      }
+    }
+  }
+
+  void encoder_prober_t::wait_idle() {
+    std::unique_lock ul {_lock};
+    _cv.wait(ul, [this]() {
+      return _idle == _threads.size();
+    });
+  }
+
+  void encoder_prober_t::run(std::vector<encoder_t *> device_encoders, const encoder_t *previous_encoder) {
+    auto fg = util::fail_guard([this]() {
+      {
+        std::lock_guard lg {_lock};
+        ++_idle;
+      }
+      _cv.notify_all();
+    });
+
+    bool speculate = true;
+    for (auto encoder : device_encoders) {
+      {
+        // Encoders of last resort (e.g. software) are slow to validate and rarely end up being used,
+        // so they're only validated once the selection asks for them
+        auto ready = [&]() {
+          return _cancel || (speculate && !(encoder->flags & ALWAYS_REPROBE)) || _requested.contains(encoder);
+        };
+
+        std::unique_lock ul {_lock};
+        if (!ready()) {
+          ++_idle;
+          _cv.notify_all();
+          _cv.wait(ul, ready);
+          --_idle;
+        }
+
+        if (_cancel) {
+          return;
+        }
+      }
+
+      auto start = std::chrono::steady_clock::now();
+
+      // If we've used a previous encoder and it's not this one, we expect this encoder to
+      // fail to validate. It will use a slightly different order of checks to more quickly
+      // eliminate failing encoders.
+      auto passed = validate_encoder(*encoder, previous_encoder && previous_encoder != encoder, &_cancel);
+      if (_cancel) {
+        // The result is incomplete and nobody is waiting for it anymore
+        return;
+      }
+
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+      BOOST_LOG(info) << "Validation of encoder ["sv << encoder->name << "] took "sv << elapsed.count() << "ms"sv;
+
+      _promises.at(encoder).set_value(passed);
+
+      // Lower priority encoders on this device are likely only needed if this one failed
+      speculate = !passed;
+    }
+  }
+
+  /**
+   * @brief Build the key that cached encoder capabilities are valid for.
+   * @return The key, or an empty string if the GPUs and drivers can't be identified.
+   */
+  std::string capability_cache_key() {
+    auto gpu_environment = platf::gpu_environment_id();
+    if (gpu_environment.empty()) {
+      return {};
+    }
+
+    // Encoder options are part of the config file, any change to it may change the outcome of validation
+    std::stringstream key;
+    key << PROJECT_VER << '|'
+        << av_version_info() << '|'
+        << LIBAVCODEC_IDENT << '|'
+        << encoder_t::MAX_FLAGS << '|'
+        << gpu_environment << '|'
+        << config::video.adapter_name << '|'
+        << display_device::map_output_name(config::video.output_name) << '|'
+        << config::video.hevc_mode << '|'
+        << config::video.av1_mode << '|'
+        << config::sunshine.flags[config::flag::FORCE_VIDEO_HEADER_REPLACE] << '|'
+        << file_handler::read_file(config::sunshine.config_file.c_str());
+
+    auto hash = crypto::hash(key.str());
+    return util::hex_vec(std::begin(hash), std::end(hash), true);
+  }
+
+  /**
+   * @brief Validate the chosen encoder again if it was selected based on capabilities loaded from disk.
+   * @details Runs on the task pool after the last stream ends, so the confirmation doesn't hold up a launch.
+   *          It gives up as soon as a stream or probe needs the encoder, and is tried again after the next stream.
+   */
+  void confirm_cached_capabilities() {
+    std::unique_lock ul {probe_lock, std::try_to_lock};
+    if (!ul || active_streams > 0 || !capability_cache_used || !chosen_encoder) {
+      return;
+    }
+
+    auto entry = capability_cache.find(chosen_encoder->name);
+    if (!entry || entry->verified) {
+      capability_cache_used = false;
+      return;
+    }
+    auto cached = *entry;
+
+    // Validation needs the encoder to itself
+    retire_warm_session();
+
+    BOOST_LOG(info) << "Confirming cached capabilities of encoder ["sv << chosen_encoder->name << ']';
+    auto passed = validate_encoder(*chosen_encoder, false, &capability_confirmation_cancel);
+    if (capability_confirmation_cancel) {
+      chosen_encoder->h264.capabilities = cached.capabilities[0];
+      chosen_encoder->hevc.capabilities = cached.capabilities[1];
+      chosen_encoder->av1.capabilities = cached.capabilities[2];
+      return;
+    }
+
+    std::array<std::uint64_t, 3> capabilities {chosen_encoder->h264.capabilities.to_ullong(), chosen_encoder->hevc.capabilities.to_ullong(), chosen_encoder->av1.capabilities.to_ullong()};
+    capability_cache.insert(chosen_encoder->name, {passed, capabilities});
+    if (!capability_cache.key().empty()) {
+      capability_cache.save(config::video.encoder_cache_file);
+    }
+    capability_cache_used = false;
+
+    if (passed == cached.passed && capabilities == cached.capabilities) {
+      BOOST_LOG(info) << "Cached capabilities of encoder ["sv << chosen_encoder->name << "] are up to date"sv;
+      return;
+    }
+
+    // The choices made from the cached capabilities may not hold anymore
+    BOOST_LOG(warning) << "Cached capabilities of encoder ["sv << chosen_encoder->name << "] are out of date, encoders will be validated again"sv;
+    capability_cache_stale = true;
+  }
+
   int probe_encoders() {
     if (!allow_encoder_probing()) {
       // Error already logged
       return -1;
     }
 
+    auto probe_lg = interrupt_capability_confirmation();
+
     auto encoder_list = encoders;
 
     // If we already have a good encoder, check to see if another probe is required
-    if (chosen_encoder && !(chosen_encoder->flags & ALWAYS_REPROBE) && !platf::needs_encoder_reenumeration()) {
+    if (chosen_encoder && !(chosen_encoder->flags & ALWAYS_REPROBE) && !platf::needs_encoder_reenumeration() && !capability_cache_stale) {
       return 0;
     }
 
+    auto cache_key = capability_cache_key();
+    if (capability_cache_stale || cache_key.empty()) {
+      capability_cache = encoder_cache::cache_t {cache_key};
+    } else if (capability_cache.key() != cache_key) {
+      capability_cache = encoder_cache::cache_t::load(config::video.encoder_cache_file, cache_key);
+    }
+    capability_cache_used = false;
+    capability_cache_stale = false;
+
+    // Whatever the outcome, the results published below are about to change
+    auto bump_generation = util::fail_guard([]() {
+      ++encoder_probe_generation;
+    });
+
     // Restart encoder selection
     auto previous_encoder = chosen_encoder;
     chosen_encoder = nullptr;
@@ -2671,7 +3332,48 @@ namespace video {
     active_av1_mode = config::video.av1_mode;
     last_encoder_probe_supported_ref_frames_invalidation = false;
 
+    BOOST_LOG(info) << "// Testing for available encoders, this may generate errors. You can safely ignore those errors. //"sv;
+
+    // Start validating every encoder without cached capabilities, the one specified by the user first
+    std::vector<encoder_t *> candidates;
+    std::copy_if(std::begin(encoder_list), std::end(encoder_list), std::back_inserter(candidates), [](encoder_t *encoder) {
+      return !capability_cache.find(encoder->name);
+    });
+    std::stable_partition(std::begin(candidates), std::end(candidates), [](encoder_t *encoder) {
+      return encoder->name == config::video.encoder;
+    });
+    if (!candidates.empty()) {
+      // Validation opens the same capture device and encoder the warm session holds on to
+      retire_warm_session();
+    }
+    encoder_prober_t prober {candidates, previous_encoder};
+
+    bool cache_updated = false;
+    auto validate = [&](encoder_t &encoder) {
+      if (auto entry = capability_cache.find(encoder.name)) {
+        BOOST_LOG(info) << "Using cached capabilities of encoder ["sv << encoder.name << ']';
+        encoder.h264.capabilities = entry->capabilities[0];
+        encoder.hevc.capabilities = entry->capabilities[1];
+        encoder.av1.capabilities = entry->capabilities[2];
+
+        // Results loaded from disk are confirmed in the background once a stream has used them
+        if (!entry->verified) {
+          capability_cache_used = true;
+        }
+        return entry->passed;
+      }
+
+      auto passed = prober.validate(encoder);
+      capability_cache.insert(encoder.name, {passed, {encoder.h264.capabilities.to_ullong(), encoder.hevc.capabilities.to_ullong(), encoder.av1.capabilities.to_ullong()}});
+
+      cache_updated = true;
+      return passed;
+    };
+
     auto adjust_encoder_constraints = [&](encoder_t *encoder) {
+      // The choice is made, and the validation of other encoders depends on the modes adjusted below
+      prober.stop();
+
       // If we can't satisfy both the encoder and codec requirement, prefer the encoder over codec support
       if (active_hevc_mode == 3 && !encoder->hevc[encoder_t::DYNAMIC_RANGE]) {
         BOOST_LOG(warning) << "Encoder ["sv << encoder->name << "] does not support HEVC Main10 on this system"sv;
@@ -2697,7 +3399,7 @@ namespace video {
 
         if (encoder->name == config::video.encoder) {
           // Remove the encoder from the list entirely if it fails validation
-          if (!validate_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
+          if (!validate(*encoder)) {
             pos = encoder_list.erase(pos);
             break;
           }
@@ -2717,15 +3419,13 @@ namespace video {
       }
     }
 
-    BOOST_LOG(info) << "// Testing for available encoders, this may generate errors. You can safely ignore those errors. //"sv;
-
     // If we haven't found an encoder yet, but we want one with specific codec support, search for that now.
     if (chosen_encoder == nullptr && (active_hevc_mode >= 2 || active_av1_mode >= 2)) {
       KITTY_WHILE_LOOP(auto pos = std::begin(encoder_list), pos != std::end(encoder_list), {
         auto encoder = *pos;
 
         // Remove the encoder from the list entirely if it fails validation
-        if (!validate_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
+        if (!validate(*encoder)) {
           pos = encoder_list.erase(pos);
           continue;
         }
@@ -2759,10 +3459,7 @@ namespace video {
       KITTY_WHILE_LOOP(auto pos = std::begin(encoder_list), pos != std::end(encoder_list), {
         auto encoder = *pos;
 
-        // If we've used a previous encoder and it's not this one, we expect this encoder to
-        // fail to validate. It will use a slightly different order of checks to more quickly
-        // eliminate failing encoders.
-        if (!validate_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
+        if (!validate(*encoder)) {
           pos = encoder_list.erase(pos);
           continue;
         }
@@ -2775,6 +3472,18 @@ namespace video {
       });
     }
 
+    // Don't keep validating encoders that weren't needed
+    prober.stop();
+
+    if (chosen_encoder == nullptr && capability_cache_used) {
+      // The cached capabilities may be stale, so start over with a full validation
+      BOOST_LOG(warning) << "No encoder is usable according to cached capabilities, validating again"sv;
+      capability_cache = encoder_cache::cache_t {cache_key};
+      capability_cache_used = false;
+
+      return probe_encoders();
+    }
+
     if (chosen_encoder == nullptr) {
       const auto output_name {display_device::map_output_name(config::video.output_name)};
       BOOST_LOG(fatal) << "Unable to find display or encoder during startup."sv;
@@ -2790,6 +3499,10 @@ namespace video {
     BOOST_LOG(info) << "// Ignore any errors mentioned above, they are not relevant. //"sv;
     BOOST_LOG(info);
 
+    if (cache_updated && !cache_key.empty()) {
+      capability_cache.save(config::video.encoder_cache_file);
+    }
+
     auto &encoder = *chosen_encoder;
 
     last_encoder_probe_supported_ref_frames_invalidation = (encoder.flags & REF_FRAMES_INVALIDATION);
@@ -2931,6 +3644,8 @@ namespace video {
   int start_capture_async(capture_thread_async_ctx_t &capture_thread_ctx) {
     capture_thread_ctx.encoder_p = chosen_encoder;
     capture_thread_ctx.reinit_event.reset();
+    capture_thread_ctx.display_released.reset();
+    capture_thread_ctx.display_ready.reset();
 
     capture_thread_ctx.capture_ctx_queue = std::make_shared<safe::queue_t<capture_ctx_t>>(30);
 
@@ -2939,6 +3654,8 @@ namespace video {
       capture_thread_ctx.capture_ctx_queue,
       std::ref(capture_thread_ctx.display_wp),
       std::ref(capture_thread_ctx.reinit_event),
+      std::ref(capture_thread_ctx.display_released),
+      std::ref(capture_thread_ctx.display_ready),
       std::ref(*capture_thread_ctx.encoder_p)
     };
 
@@ -4,6 +4,21 @@
  */
 #pragma once
 
+// standard includes
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
 // local includes
 #include "input.h"
 #include "platform/common.h"
@@ -203,18 +218,6 @@ namespace video {
     uint32_t flags;
   };
 
-  struct encode_session_t {
-    virtual ~encode_session_t() = default;
-
-    virtual int convert(platf::img_t &img) = 0;
-
-    virtual void request_idr_frame() = 0;
-
-    virtual void request_normal_frame() = 0;
-
-    virtual void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) = 0;
-  };
-
   // encoders
   extern encoder_t software;
 
@@ -246,15 +249,27 @@ namespace video {
 
     virtual size_t data_size() = 0;
 
+    /**
+     * @brief Drop the contents of the packet so it can be reused for another frame.
+     */
+    virtual void reset() {
+      replacements = nullptr;
+      channel_data = nullptr;
+      after_ref_frame_invalidation = false;
+      frame_timestamp.reset();
+    }
+
     struct replace_t {
       std::string_view old;
       std::string_view _new;
+      std::size_t offset;  ///< Where `old` was found in the first IDR frame, checked before it's relied upon
 
       KITTY_DEFAULT_CONSTR_MOVE(replace_t)
 
-      replace_t(std::string_view old, std::string_view _new) noexcept:
+      replace_t(std::string_view old, std::string_view _new, std::size_t offset = 0) noexcept:
           old {std::move(old)},
-          _new {std::move(_new)} {
+          _new {std::move(_new)},
+          offset {offset} {
       }
     };
 
@@ -289,10 +304,17 @@ namespace video {
       return av_packet->size;
     }
 
+    void reset() override {
+      packet_raw_t::reset();
+      av_packet_unref(av_packet);
+    }
+
     AVPacket *av_packet;
   };
 
   struct packet_raw_generic: packet_raw_t {
+    packet_raw_generic() = default;
+
     packet_raw_generic(std::vector<uint8_t> &&frame_data, int64_t frame_index, bool idr):
         frame_data {std::move(frame_data)},
         index {frame_index},
@@ -315,12 +337,119 @@ namespace video {
       return frame_data.size();
     }
 
+    void reset() override {
+      packet_raw_t::reset();
+
+      // Keep the capacity, the next frame is written into the same buffer
+      frame_data.clear();
+      index = 0;
+      idr = false;
+    }
+
     std::vector<uint8_t> frame_data;
-    int64_t index;
-    bool idr;
+    int64_t index = 0;
+    bool idr = false;
   };
 
-  using packet_t = std::unique_ptr<packet_raw_t>;
+  /**
+   * @brief Takes back packets once they have been sent.
+   */
+  struct packet_recycler_t {
+    virtual ~packet_recycler_t() = default;
+
+    virtual void recycle(packet_raw_t *packet) = 0;
+  };
+
+  /**
+   * @brief Returns packets to the pool they were taken from, or deletes them if they don't belong to one.
+   */
+  struct packet_deleter_t {
+    std::shared_ptr<packet_recycler_t> recycler;
+
+    void operator()(packet_raw_t *packet) const {
+      if (recycler) {
+        recycler->recycle(packet);
+      } else {
+        delete packet;
+      }
+    }
+  };
+
+  using packet_t = std::unique_ptr<packet_raw_t, packet_deleter_t>;
+
+  /**
+   * @brief Reusable packets of an encode session.
+   * @details Packets go back to the pool when the broadcast thread drops them,
+   *          so their AVPacket or payload buffer is reused for a later frame.
+   *          The pool is shared with the packets, so it outlives the session if packets are still queued.
+   * @examples
+   * auto pool = std::make_shared<video::packet_pool_t<video::packet_raw_generic>>();
+   * auto packet = pool->acquire();
+   * @examples_end
+   */
+  template<class T>
+  class packet_pool_t: public packet_recycler_t, public std::enable_shared_from_this<packet_pool_t<T>> {
+  public:
+    // A handful of frames in flight between the encode and broadcast threads is the norm
+    static constexpr std::size_t MAX_FREE_PACKETS = 8;
+
+    /**
+     * @brief Get a packet, reusing a previously recycled one if possible.
+     * @return A packet of type `T`, returned to this pool once dropped.
+     */
+    packet_t acquire() {
+      std::unique_ptr<T> packet;
+      {
+        std::lock_guard lg {_lock};
+        if (!_free.empty()) {
+          packet = std::move(_free.back());
+          _free.pop_back();
+        }
+      }
+
+      if (!packet) {
+        packet = std::make_unique<T>();
+      }
+
+      return packet_t {packet.release(), packet_deleter_t {this->shared_from_this()}};
+    }
+
+    void recycle(packet_raw_t *packet) override {
+      std::unique_ptr<T> recycled {static_cast<T *>(packet)};
+      recycled->reset();
+
+      std::lock_guard lg {_lock};
+      if (_free.size() < MAX_FREE_PACKETS) {
+        _free.emplace_back(std::move(recycled));
+      }
+    }
+
+  private:
+    std::mutex _lock;
+    std::vector<std::unique_ptr<T>> _free;
+  };
+
+  struct encode_session_t {
+    virtual ~encode_session_t() = default;
+
+    virtual int convert(platf::img_t &img) = 0;
+
+    virtual void request_idr_frame() = 0;
+
+    virtual void request_normal_frame() = 0;
+
+    virtual void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) = 0;
+
+    /**
+     * @brief Encode the converted frame and queue the resulting packets.
+     * @param frame_nr The frame number.
+     * @param packets The queue receiving the packets.
+     * @param channel_data The session the packets belong to.
+     * @param frame_timestamp The capture time of the frame, if known.
+     * @return 0 on success.
+     */
+    virtual int encode(int64_t frame_nr, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) = 0;
+  };
 
   struct hdr_info_raw_t {
     explicit hdr_info_raw_t(bool enabled):
@@ -336,18 +465,170 @@ namespace video {
 
   using hdr_info_t = std::unique_ptr<hdr_info_raw_t>;
 
+  /**
+   * @brief Decides which captured frames get encoded, keeping encodes on a steady cadence.
+   * @details Encodes are scheduled on a clock that advances by exactly one stream interval per frame and is
+   *          phase-locked to the capture timestamps. A frame is only dropped if it arrives early enough that a
+   *          later frame will land closer to the deadline, so a source running slightly faster than the stream
+   *          drops one frame every few seconds instead of beating against a fixed threshold.
+   */
+  class frame_pacer_t {
+  public:
+    using time_point = std::chrono::steady_clock::time_point;
+
+    /**
+     * @param framerate The framerate of the stream.
+     */
+    explicit frame_pacer_t(int framerate);
+
+    /**
+     * @brief Decide whether a captured frame should be encoded right away.
+     * @param timestamp The capture timestamp of the frame.
+     * @return `true` if the frame should be encoded, `false` if it's early and should be held until `deadline()`.
+     */
+    bool accept(time_point timestamp);
+
+    /**
+     * @brief Encode a held frame because no better frame arrived before the deadline.
+     * @param timestamp The capture timestamp of the held frame.
+     */
+    void release(time_point timestamp);
+
+    /**
+     * @brief The time the next frame is due, or `std::nullopt` before the first frame.
+     */
+    std::optional<time_point> deadline() const {
+      return _deadline;
+    }
+
+    /**
+     * @brief The estimated interval between captured frames.
+     */
+    std::chrono::steady_clock::duration source_interval() const {
+      return _source_interval;
+    }
+
+    /**
+     * @brief Summarize the intervals between encoded frames, e.g. "16ms: 3598, 17ms: 2".
+     */
+    std::string interval_histogram() const;
+
+    std::uint64_t encoded = 0;  ///< Number of frames accepted or released
+    std::uint64_t dropped = 0;  ///< Number of frames superseded by a later frame
+
+  private:
+    void advance(time_point timestamp);
+
+    std::chrono::steady_clock::duration _interval;
+    std::chrono::steady_clock::duration _source_interval {};
+    std::optional<time_point> _deadline;
+    std::optional<time_point> _last_captured;
+    std::optional<time_point> _last_encoded;
+    bool _holding = false;
+
+    /// Intervals between encoded frames in whole milliseconds, the last bucket collects everything longer
+    std::array<std::uint64_t, 101> _histogram {};
+  };
+
+  /**
+   * @brief Detects captured images that are identical to the previous one.
+   * @details Capture backends that copy into system memory hand over a new image on every interval, even
+   *          when nothing on screen changed. Hashing the pixels is far cheaper than converting and encoding them.
+   */
+  class frame_change_detector_t {
+  public:
+    /**
+     * @brief Check whether an image differs from the one checked before it.
+     * @param img An image in system memory.
+     * @return `true` if the contents changed, or if this is the first image since `reset()`.
+     */
+    bool changed(const platf::img_t &img);
+
+    /**
+     * @brief Forget the previous image, so the next one is reported as changed.
+     */
+    void reset() {
+      _hash.reset();
+    }
+
+  private:
+    std::optional<std::uint64_t> _hash;
+  };
+
   extern int active_hevc_mode;
   extern int active_av1_mode;
   extern bool last_encoder_probe_supported_ref_frames_invalidation;
   extern std::array<bool, 3> last_encoder_probe_supported_yuv444_for_codec;  // 0 - H.264, 1 - HEVC, 2 - AV1
 
+  /**
+   * @brief Incremented each time `probe_encoders()` re-runs encoder selection.
+   * @details Lets consumers of the probe results (e.g. cached serverinfo responses) detect stale data.
+   */
+  extern std::atomic<uint32_t> encoder_probe_generation;
+
   void capture(
     safe::mail_t mail,
     config_t config,
     void *channel_data
   );
 
-  bool validate_encoder(encoder_t &encoder, bool expect_failure);
+  /**
+   * @brief Validate an encoder and detect the capabilities of each codec it supports.
+   * @param encoder The encoder to validate.
+   * @param expect_failure Whether to order the probes so an unusable encoder is eliminated quickly.
+   * @param cancel If set, the remaining probes fail immediately once it becomes `true`.
+   * @return `true` if the encoder can be used.
+   */
+  bool validate_encoder(encoder_t &encoder, bool expect_failure, const std::atomic_bool *cancel = nullptr);
+
+  /**
+   * @brief Validates candidate encoders concurrently, ahead of the encoder selection that consumes the results.
+   * @details Encoders probed on the same device are validated one after another in priority order.
+   *          Once one of them passes, the next one is only validated if the selection asks for it.
+   *          Encoders of last resort are never validated before they are asked for.
+   */
+  class encoder_prober_t {
+  public:
+    /**
+     * @brief Start validating the candidates.
+     * @param candidates The encoders to validate, in priority order.
+     * @param previous_encoder The encoder chosen by the previous probe, if any.
+     */
+    encoder_prober_t(const std::vector<encoder_t *> &candidates, const encoder_t *previous_encoder);
+    ~encoder_prober_t();
+
+    /**
+     * @brief Get the validation result of an encoder, waiting for it if necessary.
+     * @param encoder One of the candidates.
+     * @return `true` if the encoder passed validation.
+     */
+    bool validate(encoder_t &encoder);
+
+    /**
+     * @brief Cancel the validations that are no longer needed and wait for the running ones.
+     */
+    void stop();
+
+    /**
+     * @brief Wait until no validation is running, every device either finished or waits for an encoder to be requested.
+     */
+    void wait_idle();
+
+  private:
+    void run(std::vector<encoder_t *> device_encoders, const encoder_t *previous_encoder);
+
+    std::mutex _lock;
+    std::condition_variable _cv;
+    std::atomic_bool _cancel {false};
+    std::set<const encoder_t *> _requested;
+    std::size_t _idle = 0;  ///< Device threads that finished or wait for a request
+
+    std::map<const encoder_t *, std::promise<bool>> _promises;
+    std::map<const encoder_t *, std::future<bool>> _results;
+    std::map<const encoder_t *, bool> _passed;
+
+    std::vector<std::thread> _threads;
+  };
 
   /**
    * @brief Probe encoders and select the preferred encoder.
@@ -358,4 +639,9 @@ namespace video {
    * @warning This is only safe to call when there is no client actively streaming.
    */
   int probe_encoders();
+
+  /**
+   * @brief Release the warm encode session kept for the next stream, if any.
+   */
+  void retire_warm_session();
 }  // namespace video
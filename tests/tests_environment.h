@@ -8,7 +8,7 @@
 struct SunshineEnvironment: testing::Environment {
   void SetUp() override {
     mail::man = std::make_shared<safe::mail_raw_t>();
-    deinit_log = logging::init(0, "test_sunshine.log");
+    init_log();
   }
 
   void TearDown() override {
@@ -16,5 +16,19 @@ struct SunshineEnvironment: testing::Environment {
     mail::man = {};
   }
 
+  /**
+   * @brief Initialize the log the tests write to, e.g. again after a test replaced it.
+   */
+  void init_log() {
+    // The previous guard would deinitialize the new log if it were destroyed after it
+    deinit_log = {};
+    deinit_log = logging::init(0, "test_sunshine.log");
+  }
+
   std::unique_ptr<logging::deinit_t> deinit_log;
 };
+
+/**
+ * @brief The environment registered by the entry point.
+ */
+inline SunshineEnvironment *sunshine_environment = nullptr;
@@ -8,7 +8,7 @@
 
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
-  testing::AddGlobalTestEnvironment(new SunshineEnvironment);
+  sunshine_environment = static_cast<SunshineEnvironment *>(testing::AddGlobalTestEnvironment(new SunshineEnvironment));
   testing::UnitTest::GetInstance()->listeners().Append(new SunshineEventListener);
   return RUN_ALL_TESTS();
 }
@@ -0,0 +1,169 @@
+/**
+ * @file tests/unit/test_asset_cache.cpp
+ * @brief Test src/asset_cache.*.
+ */
+// test imports
+#include "../tests_common.h"
+
+// standard imports
+#include <filesystem>
+#include <fstream>
+
+// lib imports
+#include <zlib.h>
+
+// local imports
+#include <src/asset_cache.h>
+
+struct EtagMatchesTest: testing::TestWithParam<std::tuple<std::string, bool>> {};
+
+TEST_P(EtagMatchesTest, Run) {
+  const auto &[if_none_match, expected] = GetParam();
+  ASSERT_EQ(asset_cache::etag_matches(if_none_match, "\"ABCD\""), expected);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  EtagMatchesTests,
+  EtagMatchesTest,
+  testing::Values(
+    std::make_tuple("\"ABCD\"", true),
+    std::make_tuple("W/\"ABCD\"", true),
+    std::make_tuple("\"1234\", \"ABCD\"", true),
+    std::make_tuple("*", true),
+    std::make_tuple("\"1234\"", false),
+    std::make_tuple("ABCD", false),
+    std::make_tuple("", false)
+  )
+);
+
+struct AcceptsGzipTest: testing::TestWithParam<std::tuple<std::string, bool>> {};
+
+TEST_P(AcceptsGzipTest, Run) {
+  const auto &[accept_encoding, expected] = GetParam();
+  ASSERT_EQ(asset_cache::accepts_gzip(accept_encoding), expected);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  AcceptsGzipTests,
+  AcceptsGzipTest,
+  testing::Values(
+    std::make_tuple("gzip", true),
+    std::make_tuple("gzip, deflate, br", true),
+    std::make_tuple("br;q=1.0, GZIP;q=0.5", true),
+    std::make_tuple("*", true),
+    std::make_tuple("gzip;q=0", false),
+    std::make_tuple("br, deflate", false),
+    std::make_tuple("", false)
+  )
+);
+
+TEST(AssetCacheTest, GzipRoundTrip) {
+  std::string data;
+  for (int x = 0; x < 1000; ++x) {
+    data += "<div class=\"row\">" + std::to_string(x) + "</div>\n";
+  }
+
+  auto compressed = asset_cache::gzip(data);
+  ASSERT_FALSE(compressed.empty());
+  ASSERT_LT(compressed.size(), data.size());
+
+  z_stream stream {};
+  ASSERT_EQ(inflateInit2(&stream, 15 + 16), Z_OK);
+
+  std::string decompressed(data.size(), '\0');
+  stream.next_in = (Bytef *) compressed.data();
+  stream.avail_in = (uInt) compressed.size();
+  stream.next_out = (Bytef *) decompressed.data();
+  stream.avail_out = (uInt) decompressed.size();
+
+  EXPECT_EQ(inflate(&stream, Z_FINISH), Z_STREAM_END);
+  EXPECT_EQ(stream.total_out, data.size());
+  inflateEnd(&stream);
+
+  EXPECT_EQ(decompressed, data);
+}
+
+TEST(AssetCacheTest, MakeAsset) {
+  auto text = asset_cache::make_asset(std::string(4096, 'a'), "text/css", true);
+  EXPECT_EQ(text->content_type, "text/css");
+  EXPECT_EQ(text->etag, asset_cache::make_etag(std::string(4096, 'a')));
+  EXPECT_FALSE(text->gzip_data.empty());
+
+  // The gzip variant is a different representation, with its own strong ETag
+  EXPECT_NE(text->gzip_etag, text->etag);
+  EXPECT_EQ(text->gzip_etag, text->etag.substr(0, text->etag.size() - 1) + "-gz\"");
+  EXPECT_FALSE(asset_cache::etag_matches(text->gzip_etag, text->etag));
+
+  // Compression that doesn't pay off is dropped
+  auto tiny = asset_cache::make_asset("a", "text/plain", true);
+  EXPECT_TRUE(tiny->gzip_data.empty());
+  EXPECT_TRUE(tiny->gzip_etag.empty());
+
+  auto other = asset_cache::make_asset(std::string(4096, 'b'), "text/css", true);
+  EXPECT_NE(text->etag, other->etag);
+}
+
+TEST(AssetCacheTest, LoadDirectory) {
+  const auto root = std::filesystem::temp_directory_path() / "sunshine_asset_cache_test";
+  std::filesystem::remove_all(root);
+  std::filesystem::create_directories(root / "assets");
+
+  std::ofstream(root / "index.html") << "<html></html>";
+  std::ofstream(root / "assets" / "app.js") << "console.log('hello');";
+  std::ofstream(root / "assets" / "unknown.bin") << "ignored";
+
+  asset_cache::cache_t cache;
+  EXPECT_EQ(cache.load_directory(root, {{"html", "text/html"}, {"js", "application/javascript"}}), 2);
+
+  auto page = cache.find("index.html");
+  ASSERT_TRUE(page);
+  EXPECT_EQ(page->data, "<html></html>");
+  EXPECT_EQ(page->content_type, "text/html");
+
+  auto script = cache.find("assets/app.js");
+  ASSERT_TRUE(script);
+  EXPECT_EQ(script->content_type, "application/javascript");
+
+  EXPECT_FALSE(cache.find("assets/unknown.bin"));
+  EXPECT_FALSE(cache.find("../index.html"));
+
+  std::filesystem::remove_all(root);
+}
+
+TEST(AssetCacheTest, FileCache) {
+  const auto root = std::filesystem::temp_directory_path() / "sunshine_file_cache_test";
+  std::filesystem::remove_all(root);
+  std::filesystem::create_directories(root);
+
+  std::ofstream(root / "a.png") << std::string(40, 'a');
+  std::ofstream(root / "b.png") << std::string(40, 'b');
+  std::ofstream(root / "c.png") << std::string(40, 'c');
+
+  asset_cache::file_cache_t cache {100};
+
+  auto a = cache.load(root / "a.png", "image/png");
+  ASSERT_TRUE(a);
+  EXPECT_EQ(a->data, std::string(40, 'a'));
+  EXPECT_EQ(a->content_type, "image/png");
+  EXPECT_EQ(cache.load(root / "a.png", "image/png"), a);
+
+  // Changed files are read again
+  std::ofstream(root / "a.png") << std::string(50, 'A');
+  auto changed = cache.load(root / "a.png", "image/png");
+  ASSERT_TRUE(changed);
+  EXPECT_EQ(changed->data, std::string(50, 'A'));
+  EXPECT_NE(changed->etag, a->etag);
+  EXPECT_EQ(cache.size_bytes(), 50);
+
+  // The least recently used file makes room for new ones
+  auto b = cache.load(root / "b.png", "image/png");
+  EXPECT_EQ(cache.load(root / "a.png", "image/png"), changed);
+  EXPECT_TRUE(cache.load(root / "c.png", "image/png"));
+  EXPECT_EQ(cache.size_bytes(), 90);
+  EXPECT_EQ(cache.load(root / "a.png", "image/png"), changed);
+  EXPECT_NE(cache.load(root / "b.png", "image/png"), b);
+
+  EXPECT_FALSE(cache.load(root / "missing.png", "image/png"));
+
+  std::filesystem::remove_all(root);
+}
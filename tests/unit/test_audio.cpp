@@ -67,3 +67,29 @@ TEST_P(AudioTest, TestEncode) {
   timer.join();
   capture.join();
 }
+
+TEST(BufferPoolTest, ReusesBuffers) {
+  buffer_pool_t<std::vector<float>> pool {2};
+
+  EXPECT_FALSE(pool.take());
+  EXPECT_EQ(pool.allocated, 1);
+
+  std::vector<float> buffer(480);
+  auto data = buffer.data();
+  pool.give(std::move(buffer));
+
+  auto reused = pool.take();
+  ASSERT_TRUE(reused);
+  EXPECT_EQ(reused->data(), data);
+  EXPECT_EQ(pool.reused, 1);
+
+  // Idle buffers beyond the capacity are freed
+  pool.give(std::vector<float>(1));
+  pool.give(std::vector<float>(2));
+  pool.give(std::vector<float>(3));
+  EXPECT_TRUE(pool.take());
+  EXPECT_TRUE(pool.take());
+  EXPECT_FALSE(pool.take());
+  EXPECT_EQ(pool.allocated, 2);
+  EXPECT_EQ(pool.reused, 3);
+}
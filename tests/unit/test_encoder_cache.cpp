@@ -0,0 +1,85 @@
+/**
+ * @file tests/unit/test_encoder_cache.cpp
+ * @brief Test src/encoder_cache.*.
+ */
+// test imports
+#include "../tests_common.h"
+
+// standard imports
+#include <filesystem>
+#include <fstream>
+
+// local imports
+#include <src/encoder_cache.h>
+
+struct EncoderCacheTest: testing::Test {
+  void SetUp() override {
+    file = std::filesystem::temp_directory_path() / "sunshine_encoder_cache_test.json";
+    std::filesystem::remove(file);
+  }
+
+  void TearDown() override {
+    std::filesystem::remove(file);
+  }
+
+  std::filesystem::path file;
+};
+
+TEST_F(EncoderCacheTest, RoundTrip) {
+  encoder_cache::cache_t cache {"key"};
+  cache.insert("nvenc", {true, {0x1F, 0x03, 0}});
+  cache.insert("quicksync", {false, {0, 0, 0}});
+  ASSERT_TRUE(cache.save(file));
+
+  auto loaded = encoder_cache::cache_t::load(file, "key");
+  EXPECT_EQ(loaded.key(), "key");
+
+  auto nvenc = loaded.find("nvenc");
+  ASSERT_TRUE(nvenc);
+  EXPECT_TRUE(nvenc->passed);
+  EXPECT_EQ(nvenc->capabilities[0], 0x1F);
+  EXPECT_EQ(nvenc->capabilities[1], 0x03);
+  EXPECT_EQ(nvenc->capabilities[2], 0);
+
+  auto quicksync = loaded.find("quicksync");
+  ASSERT_TRUE(quicksync);
+  EXPECT_FALSE(quicksync->passed);
+
+  EXPECT_FALSE(loaded.find("software"));
+}
+
+TEST_F(EncoderCacheTest, Verified) {
+  encoder_cache::cache_t cache {"key"};
+  cache.insert("nvenc", {true, {1, 1, 1}});
+  ASSERT_TRUE(cache.find("nvenc"));
+  EXPECT_TRUE(cache.find("nvenc")->verified);
+  ASSERT_TRUE(cache.save(file));
+
+  // Results read back from disk have to be confirmed before they are trusted again
+  auto loaded = encoder_cache::cache_t::load(file, "key");
+  ASSERT_TRUE(loaded.find("nvenc"));
+  EXPECT_FALSE(loaded.find("nvenc")->verified);
+
+  loaded.insert("nvenc", {true, {1, 1, 1}});
+  EXPECT_TRUE(loaded.find("nvenc")->verified);
+}
+
+TEST_F(EncoderCacheTest, KeyMismatch) {
+  encoder_cache::cache_t cache {"old driver"};
+  cache.insert("nvenc", {true, {1, 1, 1}});
+  ASSERT_TRUE(cache.save(file));
+
+  auto loaded = encoder_cache::cache_t::load(file, "new driver");
+  EXPECT_EQ(loaded.key(), "new driver");
+  EXPECT_TRUE(loaded.empty());
+}
+
+TEST_F(EncoderCacheTest, InvalidFile) {
+  EXPECT_TRUE(encoder_cache::cache_t::load(file, "key").empty());
+
+  std::ofstream(file) << R"({"key": "key", "encoders": {"nvenc": {"passed": true}}})";
+  EXPECT_TRUE(encoder_cache::cache_t::load(file, "key").empty());
+
+  std::ofstream(file) << "{";
+  EXPECT_TRUE(encoder_cache::cache_t::load(file, "key").empty());
+}
@@ -3,9 +3,13 @@
  * @brief Test src/logging.*.
  */
 #include "../tests_common.h"
+#include "../tests_environment.h"
 #include "../tests_log_checker.h"
 
+#include <filesystem>
+#include <fstream>
 #include <random>
+#include <thread>
 #include <src/logging.h>
 
 namespace {
@@ -44,3 +48,118 @@ TEST_P(LogLevelsTest, PutMessage) {
 
   ASSERT_TRUE(log_checker::line_contains(log_file, test_message));
 }
+
+TEST(LogTailTest, Wraparound) {
+  logging::log_tail_t tail(8);
+
+  // Only the last 8 bytes are kept
+  tail.append("0123456789");
+  EXPECT_EQ(tail.end_offset(), 10);
+
+  std::string out;
+  EXPECT_FALSE(tail.read(1, 100, out));
+  ASSERT_TRUE(tail.read(2, 100, out));
+  EXPECT_EQ(out, "23456789");
+
+  tail.append("ab");
+  ASSERT_TRUE(tail.read(8, 100, out));
+  EXPECT_EQ(out, "89ab");
+  ASSERT_TRUE(tail.read(8, 3, out));
+  EXPECT_EQ(out, "89a");
+  ASSERT_TRUE(tail.read(12, 100, out));
+  EXPECT_EQ(out, "");
+
+  EXPECT_TRUE(tail.wait_for(11, std::chrono::milliseconds(1)));
+  EXPECT_FALSE(tail.wait_for(12, std::chrono::milliseconds(1)));
+}
+
+TEST(LogTailTest, MatchesLogFile) {
+  BOOST_LOG(info) << "Log tail test message";
+  logging::log_flush();
+
+  std::ifstream in(log_file, std::ios::binary);
+  std::string content {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+  ASSERT_FALSE(content.empty());
+
+  auto chunk = logging::read_log(0, content.size());
+  EXPECT_EQ(chunk.begin, 0);
+  EXPECT_EQ(chunk.data, content);
+
+  // Reading from the middle of the log returns the rest of it
+  auto half = content.size() / 2;
+  chunk = logging::read_log(half, content.size());
+  EXPECT_EQ(chunk.begin, half);
+  EXPECT_EQ(chunk.end, chunk.begin + chunk.data.size());
+  EXPECT_EQ(chunk.data.substr(0, content.size() - half), content.substr(half));
+}
+
+TEST(LogGatingTest, SkipsDisabledLevels) {
+  auto previous = logging::min_level.exchange(2);
+
+  int evaluated = 0;
+  auto count = [&evaluated]() {
+    return ++evaluated;
+  };
+
+  SUNSHINE_LOG(verbose) << count();
+  SUNSHINE_LOG(debug) << count();
+  EXPECT_EQ(evaluated, 0);
+
+  SUNSHINE_LOG(info) << count();
+  EXPECT_EQ(evaluated, 1);
+
+  EXPECT_FALSE(logging::enabled(debug));
+  EXPECT_TRUE(logging::enabled(info));
+  EXPECT_TRUE(logging::enabled(fatal));
+
+  logging::min_level = previous;
+}
+
+struct LogBatchTest: testing::Test {
+  static constexpr auto batch_log_file = "test_sunshine_batch.log";
+
+  void TearDown() override {
+    // The log of the other tests was replaced by the batched one
+    deinit_log = {};
+    sunshine_environment->init_log();
+
+    std::filesystem::remove(batch_log_file);
+    std::filesystem::remove(std::string {batch_log_file} + ".backup");
+  }
+
+  static std::string read_log_file() {
+    std::ifstream in(batch_log_file, std::ios::binary);
+    return std::string {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+  }
+
+  std::unique_ptr<logging::deinit_t> deinit_log;
+};
+
+TEST_F(LogBatchTest, FlushesInOrder) {
+  constexpr auto flush_interval = std::chrono::milliseconds(100);
+
+  deinit_log = logging::init(0, batch_log_file, flush_interval);
+  for (int x = 0; x < 50; ++x) {
+    BOOST_LOG(info) << "Batched record " << x << '.';
+  }
+
+  // Nothing else is logged, so the flush thread has to write the batch out
+  std::string content;
+  auto deadline = std::chrono::steady_clock::now() + 20 * flush_interval;
+  while ((content = read_log_file()).find("Batched record 49.") == std::string::npos && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(flush_interval / 10);
+  }
+
+  std::size_t pos = 0;
+  for (int x = 0; x < 50; ++x) {
+    auto next = content.find("Batched record " + std::to_string(x) + '.', pos);
+    ASSERT_NE(next, std::string::npos) << "record " << x;
+    pos = next;
+  }
+
+  BOOST_LOG(info) << "Record before shutdown";
+  deinit_log = {};
+
+  // Deinitializing flushes whatever is still batched
+  EXPECT_NE(read_log_file().find("Record before shutdown"), std::string::npos);
+}
@@ -0,0 +1,144 @@
+/**
+ * @file tests/unit/test_nvhttp_state.cpp
+ * @brief Test the persistence of paired clients in src/nvhttp.*.
+ */
+#include "../tests_common.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include <src/config.h>
+#include <src/httpcommon.h>
+#include <src/nvhttp.h>
+
+namespace fs = std::filesystem;
+
+struct StateJournalTest: testing::Test {
+  void SetUp() override {
+    dir = fs::temp_directory_path() / "sunshine_state_journal_test";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    previous_file_state = config::nvhttp.file_state;
+    previous_unique_id = http::unique_id;
+    previous_uuid = http::uuid;
+    config::nvhttp.file_state = (dir / "sunshine_state.json").string();
+  }
+
+  void TearDown() override {
+    nvhttp::erase_all_clients();
+
+    config::nvhttp.file_state = previous_file_state;
+    http::unique_id = previous_unique_id;
+    http::uuid = previous_uuid;
+    fs::remove_all(dir);
+  }
+
+  static void append(const fs::path &file, const std::string &line) {
+    std::ofstream(file, std::ios::app) << line << '\n';
+  }
+
+  static std::string put(const std::string &uuid, const std::string &name) {
+    return nlohmann::json {{"put", {{"uuid", uuid}, {"name", name}, {"cert", "cert-" + uuid}}}}.dump();
+  }
+
+  static nlohmann::json read_state() {
+    nlohmann::json tree;
+    std::ifstream(config::nvhttp.file_state) >> tree;
+    return tree;
+  }
+
+  fs::path dir;
+  std::string previous_file_state;
+  std::string previous_unique_id;
+  uuid_util::uuid_t previous_uuid;
+};
+
+TEST_F(StateJournalTest, Replay) {
+  auto journal = dir / "journal";
+  append(journal, put("a", "first"));
+  append(journal, put("b", "second"));
+  append(journal, put("a", "renamed"));
+  append(journal, R"({"remove": "b"})");
+
+  nvhttp::client_t client;
+  EXPECT_EQ(nvhttp::replay_state_journal(journal, client), 4);
+  ASSERT_EQ(client.named_devices.size(), 1);
+  EXPECT_EQ(client.named_devices[0]->uuid, "a");
+  EXPECT_EQ(client.named_devices[0]->name, "renamed");
+  EXPECT_EQ(client.named_devices[0]->cert, "cert-a");
+}
+
+TEST_F(StateJournalTest, TornLastLine) {
+  auto journal = dir / "journal";
+  append(journal, put("a", "first"));
+  std::ofstream(journal, std::ios::app) << R"({"put": {"uuid": "b", "na)";
+
+  nvhttp::client_t client;
+  EXPECT_EQ(nvhttp::replay_state_journal(journal, client), 1);
+  ASSERT_EQ(client.named_devices.size(), 1);
+  EXPECT_EQ(client.named_devices[0]->uuid, "a");
+}
+
+TEST_F(StateJournalTest, TornLineThenAppends) {
+  std::ofstream(config::nvhttp.file_state) << R"({"root": {"uniqueid": "4D7BB2DD-5704-A405-B41C-891A022932E1", "named_devices": []}})";
+
+  // A crash tore the only change in the journal
+  auto journal = config::nvhttp.file_state + ".journal";
+  std::ofstream(journal) << R"({"put": {"uuid": "a", "na)";
+
+  // Loading must drop the torn line, or the changes appended next would be glued to it
+  nvhttp::load_state();
+  EXPECT_FALSE(fs::exists(journal));
+
+  append(journal, put("b", "paired after the crash"));
+  append(journal, put("c", "paired later"));
+  nvhttp::load_state();
+
+  auto named_devices = read_state()["root"]["named_devices"];
+  ASSERT_EQ(named_devices.size(), 2);
+  EXPECT_EQ(named_devices[0]["uuid"], "b");
+  EXPECT_EQ(named_devices[1]["uuid"], "c");
+}
+
+TEST_F(StateJournalTest, OldJournalFirst) {
+  std::ofstream(config::nvhttp.file_state) << R"({"root": {"uniqueid": "4D7BB2DD-5704-A405-B41C-891A022932E1", "named_devices": []}})";
+
+  // A compaction was pending when the journal was rotated, the current journal holds the later changes
+  auto old_journal = config::nvhttp.file_state + ".journal.old";
+  append(old_journal, put("a", "old"));
+  append(old_journal, put("b", "removed"));
+
+  auto journal = config::nvhttp.file_state + ".journal";
+  append(journal, put("a", "new"));
+  append(journal, R"({"remove": "b"})");
+
+  nvhttp::load_state();
+
+  // Both journals are folded into the state file
+  EXPECT_FALSE(fs::exists(old_journal));
+  EXPECT_FALSE(fs::exists(journal));
+
+  auto named_devices = read_state()["root"]["named_devices"];
+  ASSERT_EQ(named_devices.size(), 1);
+  EXPECT_EQ(named_devices[0]["uuid"], "a");
+  EXPECT_EQ(named_devices[0]["name"], "new");
+}
+
+TEST_F(StateJournalTest, WriteStateRefusesOlderSnapshot) {
+  // Writes the state file with the latest snapshot
+  nvhttp::erase_all_clients();
+
+  // A compaction that was queued before must not overwrite it
+  auto stale = nlohmann::json::array({nlohmann::json {{"uuid", "a"}, {"name", "stale"}, {"cert", "cert-a"}}});
+  EXPECT_FALSE(nvhttp::write_state(stale, 0));
+  EXPECT_TRUE(read_state()["root"]["named_devices"].empty());
+}
+
+TEST_F(StateJournalTest, WriteStateKeepsOtherKeys) {
+  std::ofstream(config::nvhttp.file_state) << R"({"username": "user", "root": {"uniqueid": "4D7BB2DD-5704-A405-B41C-891A022932E1", "named_devices": []}})";
+  nvhttp::load_state();
+
+  nvhttp::erase_all_clients();
+  EXPECT_EQ(read_state()["username"], "user");
+}
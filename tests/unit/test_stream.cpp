@@ -5,35 +5,113 @@
 
 #include <cstdint>
 #include <functional>
+#include <span>
 #include <string>
 #include <vector>
 
+#include <src/video.h>
+
 namespace stream {
-  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2);
+  std::string_view gather_and_insert(uint64_t insert_size, uint64_t slice_size, std::span<const std::string_view> data, std::vector<uint8_t> &result);
+  std::size_t splice_replacements(const std::string_view &payload, const std::vector<video::packet_raw_t::replace_t> &replacements, std::vector<std::string_view> &pieces);
 }
 
 #include "../tests_common.h"
 
-TEST(ConcatAndInsertTests, ConcatNoInsertionTest) {
+using namespace std::literals;
+
+namespace {
+  std::vector<uint8_t> gather(uint64_t insert_size, uint64_t slice_size, std::span<const std::string_view> data) {
+    std::vector<uint8_t> result;
+    auto gathered = stream::gather_and_insert(insert_size, slice_size, data, result);
+    return {std::begin(gathered), std::end(gathered)};
+  }
+}  // namespace
+
+TEST(GatherAndInsertTests, ConcatNoInsertionTest) {
   char b1[] = {'a', 'b'};
   char b2[] = {'c', 'd', 'e'};
-  auto res = stream::concat_and_insert(0, 2, std::string_view {b1, sizeof(b1)}, std::string_view {b2, sizeof(b2)});
+  std::array data {std::string_view {b1, sizeof(b1)}, std::string_view {b2, sizeof(b2)}};
+  auto res = gather(0, 2, data);
   auto expected = std::vector<uint8_t> {'a', 'b', 'c', 'd', 'e'};
   ASSERT_EQ(res, expected);
 }
 
-TEST(ConcatAndInsertTests, ConcatLargeStrideTest) {
+TEST(GatherAndInsertTests, ConcatLargeStrideTest) {
   char b1[] = {'a', 'b'};
   char b2[] = {'c', 'd', 'e'};
-  auto res = stream::concat_and_insert(1, sizeof(b1) + sizeof(b2) + 1, std::string_view {b1, sizeof(b1)}, std::string_view {b2, sizeof(b2)});
+  std::array data {std::string_view {b1, sizeof(b1)}, std::string_view {b2, sizeof(b2)}};
+  auto res = gather(1, sizeof(b1) + sizeof(b2) + 1, data);
   auto expected = std::vector<uint8_t> {0, 'a', 'b', 'c', 'd', 'e'};
   ASSERT_EQ(res, expected);
 }
 
-TEST(ConcatAndInsertTests, ConcatSmallStrideTest) {
+TEST(GatherAndInsertTests, ConcatSmallStrideTest) {
   char b1[] = {'a', 'b'};
   char b2[] = {'c', 'd', 'e'};
-  auto res = stream::concat_and_insert(1, 1, std::string_view {b1, sizeof(b1)}, std::string_view {b2, sizeof(b2)});
+  std::array data {std::string_view {b1, sizeof(b1)}, std::string_view {b2, sizeof(b2)}};
+  auto res = gather(1, 1, data);
   auto expected = std::vector<uint8_t> {0, 'a', 0, 'b', 0, 'c', 0, 'd', 0, 'e'};
   ASSERT_EQ(res, expected);
 }
+
+TEST(GatherAndInsertTests, ManyBuffersTest) {
+  std::array data {"ab"sv, ""sv, "c"sv, "defg"sv};
+  auto res = gather(1, 3, data);
+  auto expected = std::vector<uint8_t> {0, 'a', 'b', 'c', 0, 'd', 'e', 'f', 0, 'g'};
+  ASSERT_EQ(res, expected);
+}
+
+TEST(GatherAndInsertTests, ReusedBufferTest) {
+  std::vector<uint8_t> result(16, 0xFF);
+
+  std::array data {"abcd"sv};
+  auto gathered = stream::gather_and_insert(1, 2, data, result);
+
+  // Inserted space is cleared and the buffer isn't shrunk
+  ASSERT_EQ(gathered, std::string_view("\0ab\0cd", 6));
+  ASSERT_EQ(result.size(), 16);
+}
+
+struct SpliceReplacementsTest: testing::TestWithParam<std::tuple<std::size_t, std::size_t>> {};
+
+TEST_P(SpliceReplacementsTest, Run) {
+  const auto &[vps_offset, sps_offset] = GetParam();
+
+  std::vector<video::packet_raw_t::replace_t> replacements;
+  replacements.emplace_back("VPS"sv, "vps!"sv, vps_offset);
+  replacements.emplace_back("SPS"sv, "s"sv, sps_offset);
+
+  std::vector<std::string_view> pieces;
+  auto size = stream::splice_replacements("AUD VPS SPS PPS SLICE SPS"sv, replacements, pieces);
+
+  std::string result;
+  for (auto &piece : pieces) {
+    result += piece;
+  }
+
+  // Wrong offsets fall back to replacing the first occurrence
+  ASSERT_EQ(result, "AUD vps! s PPS SLICE SPS");
+  ASSERT_EQ(size, result.size());
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  SpliceReplacementsTests,
+  SpliceReplacementsTest,
+  testing::Values(
+    std::make_tuple(4, 8),
+    std::make_tuple(0, 0),
+    std::make_tuple(100, 100)
+  )
+);
+
+TEST(SpliceReplacementsTests, NotFoundTest) {
+  std::vector<video::packet_raw_t::replace_t> replacements;
+  replacements.emplace_back("SPS"sv, "s"sv, 0);
+
+  std::vector<std::string_view> pieces;
+  auto size = stream::splice_replacements("PPS SLICE"sv, replacements, pieces);
+
+  ASSERT_EQ(pieces, std::vector<std::string_view> {"PPS SLICE"sv});
+  ASSERT_EQ(size, 9);
+}
@@ -48,3 +48,194 @@ INSTANTIATE_TEST_SUITE_P(
 TEST_P(EncoderTest, ValidateEncoder) {
   // todo:: test something besides fixture setup
 }
+
+TEST(PacketPoolTest, RecyclesPackets) {
+  auto pool = std::make_shared<video::packet_pool_t<video::packet_raw_generic>>();
+
+  auto packet = pool->acquire();
+  auto generic = static_cast<video::packet_raw_generic *>(packet.get());
+  generic->frame_data.resize(1024);
+  generic->idr = true;
+  auto data = generic->data();
+  packet.reset();
+
+  // In steady state the same packet and payload buffer come back every frame
+  for (int x = 0; x < 10; ++x) {
+    auto reused = pool->acquire();
+    auto reused_generic = static_cast<video::packet_raw_generic *>(reused.get());
+    ASSERT_EQ(reused_generic, generic);
+    EXPECT_FALSE(reused->is_idr());
+    EXPECT_EQ(reused->data_size(), 0);
+
+    reused_generic->frame_data.resize(1024);
+    EXPECT_EQ(reused->data(), data);
+  }
+}
+
+TEST(PacketPoolTest, OutlivesSession) {
+  auto pool = std::make_shared<video::packet_pool_t<video::packet_raw_generic>>();
+  std::weak_ptr weak_pool = pool;
+
+  {
+    auto packet = pool->acquire();
+
+    // Packets still queued for sending keep the pool alive
+    pool.reset();
+    EXPECT_FALSE(weak_pool.expired());
+  }
+
+  EXPECT_TRUE(weak_pool.expired());
+}
+
+namespace {
+  /**
+   * @brief Feed a steady capture cadence through a pacer.
+   * @return The number of frames that were encoded.
+   */
+  std::uint64_t pace(video::frame_pacer_t &pacer, std::chrono::nanoseconds capture_interval, int frames) {
+    std::chrono::steady_clock::time_point start;
+    for (int x = 0; x < frames; ++x) {
+      pacer.accept(start + capture_interval * x);
+    }
+
+    return pacer.encoded;
+  }
+}  // namespace
+
+TEST(FramePacerTest, MatchingRate) {
+  video::frame_pacer_t pacer {60};
+  EXPECT_EQ(pace(pacer, 16'666'667ns, 600), 600);
+  EXPECT_EQ(pacer.dropped, 0);
+  EXPECT_EQ(pacer.interval_histogram(), "17ms: 599");
+}
+
+TEST(FramePacerTest, SlightlyFasterSource) {
+  // 60.02 Hz into a 60 fps stream, 30 seconds worth of frames
+  video::frame_pacer_t pacer {60};
+  auto encoded = pace(pacer, 16'661'113ns, 1801);
+
+  // Exactly one surplus frame, not a frame dropped every time the phases cross
+  EXPECT_EQ(pacer.dropped, 1);
+  EXPECT_EQ(encoded, 1800);
+}
+
+TEST(FramePacerTest, FasterSource) {
+  // 144 Hz into a 60 fps stream must still produce 60 fps
+  video::frame_pacer_t pacer {60};
+  auto encoded = pace(pacer, 6'944'444ns, 1440);
+
+  EXPECT_NEAR(encoded, 600, 1);
+  EXPECT_EQ(pacer.source_interval(), 6'944'444ns);
+}
+
+TEST(FramePacerTest, HeldFrame) {
+  video::frame_pacer_t pacer {60};
+  std::chrono::steady_clock::time_point start;
+
+  EXPECT_TRUE(pacer.accept(start));
+  EXPECT_TRUE(pacer.accept(start + 16ms));
+
+  // Too early, the caller holds it until the deadline
+  EXPECT_FALSE(pacer.accept(start + 20ms));
+  ASSERT_TRUE(pacer.deadline());
+  pacer.release(start + 20ms);
+  EXPECT_EQ(pacer.encoded, 3);
+  EXPECT_EQ(pacer.dropped, 0);
+
+  // A stall resyncs the clock instead of bursting frames to catch up
+  EXPECT_TRUE(pacer.accept(start + 500ms));
+  EXPECT_FALSE(pacer.accept(start + 505ms));
+  EXPECT_TRUE(pacer.accept(start + 516ms));
+}
+
+TEST(FrameChangeDetectorTest, DetectsChanges) {
+  // Odd width and padded rows, so both the tail bytes and the padding are exercised
+  std::vector<std::uint8_t> pixels(17 * 4 * 8 + 12 * 8, 0x40);
+
+  platf::img_t img;
+  img.data = pixels.data();
+  img.width = 17;
+  img.height = 8;
+  img.pixel_pitch = 4;
+  img.row_pitch = 17 * 4 + 12;
+
+  video::frame_change_detector_t detector;
+  EXPECT_TRUE(detector.changed(img));
+  EXPECT_FALSE(detector.changed(img));
+
+  // The last pixel of the last row
+  pixels[7 * img.row_pitch + 17 * 4 - 1] = 0x41;
+  EXPECT_TRUE(detector.changed(img));
+  EXPECT_FALSE(detector.changed(img));
+
+  // Row padding isn't part of the image
+  pixels[3 * img.row_pitch + 17 * 4] = 0;
+  EXPECT_FALSE(detector.changed(img));
+
+  detector.reset();
+  EXPECT_TRUE(detector.changed(img));
+}
+
+TEST(FrameChangeDetectorTest, DetectsCompensatingChanges) {
+  std::vector<std::uint8_t> pixels(16 * 4 * 2, 0x40);
+
+  platf::img_t img;
+  img.data = pixels.data();
+  img.width = 16;
+  img.height = 2;
+  img.pixel_pitch = 4;
+  img.row_pitch = 16 * 4;
+
+  video::frame_change_detector_t detector;
+  EXPECT_TRUE(detector.changed(img));
+
+  // The top bit of two consecutive words hashed by the same lane, flips that a plain multiply would cancel out
+  pixels[7] ^= 0x80;
+  pixels[32 + 7] ^= 0x80;
+  EXPECT_TRUE(detector.changed(img));
+
+  pixels[7] ^= 0x80;
+  pixels[32 + 7] ^= 0x80;
+  EXPECT_TRUE(detector.changed(img));
+
+  // The same word of two rows
+  pixels[7] ^= 0x80;
+  pixels[img.row_pitch + 7] ^= 0x80;
+  EXPECT_TRUE(detector.changed(img));
+}
+
+struct EncoderProberTest: PlatformTestSuite {
+  void SetUp() override {
+    capabilities = {video::software.h264.capabilities, video::software.hevc.capabilities, video::software.av1.capabilities};
+  }
+
+  void TearDown() override {
+    video::software.h264.capabilities = capabilities[0];
+    video::software.hevc.capabilities = capabilities[1];
+    video::software.av1.capabilities = capabilities[2];
+  }
+
+  std::array<decltype(video::software.h264.capabilities), 3> capabilities;
+};
+
+TEST_F(EncoderProberTest, StopSkipsLastResort) {
+  video::software.h264.capabilities.reset();
+  video::software.hevc.capabilities.reset();
+  video::software.av1.capabilities.reset();
+
+  {
+    // The software encoder is only validated once it is asked for
+    video::encoder_prober_t prober {{&video::software}, nullptr};
+    prober.wait_idle();
+    prober.stop();
+  }
+
+  EXPECT_TRUE(video::software.h264.capabilities.none());
+  EXPECT_TRUE(video::software.hevc.capabilities.none());
+  EXPECT_TRUE(video::software.av1.capabilities.none());
+}
+
+TEST_F(EncoderProberTest, CancelledValidationFails) {
+  std::atomic_bool cancel {true};
+  EXPECT_FALSE(video::validate_encoder(video::software, false, &cancel));
+}